@@ -0,0 +1,227 @@
+/**
+ * File: benchmark.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Times the note path, scheduler,
+ * graphics update, and synthesis
+ * and reports the results as CSV.
+ */
+
+#include "benchmark.h"
+#include "synthesizer.h"
+#include "sequencer.h"
+#include "masterbus.h"
+#include "mapper.h"
+#include "ofApp.h"
+#include <stdlib.h>
+#include <sstream>
+using namespace std;
+
+/**
+ * Function: run
+ * -------------
+ * Runs the whole suite. Rows are
+ * benchmark, parameter, iterations,
+ * total microseconds, and nanoseconds
+ * per operation.
+ */
+void Benchmark::run(ostream& output, const string fontPath) {
+  out = &output; // shared by report
+  output << "benchmark,parameter,iterations,total_us,ns_per_op" << endl;
+
+  benchMapper();
+
+  int layerCounts[] = {1, 8, 16, 64};
+  int noteCounts[] = {64, 1024, 8192};
+  for (int i = 0; i < 4; i += 1)
+    for (int j = 0; j < 3; j += 1)
+      benchScheduler(layerCounts[i], noteCounts[j]);
+
+  int blockCounts[] = {500, 2000, 8000};
+  for (int i = 0; i < 3; i += 1)
+    benchGraphics(blockCounts[i]);
+
+  int polyphonies[] = {16, 64, 256};
+  for (int i = 0; i < 3; i += 1)
+    benchSynthesis(fontPath, polyphonies[i]);
+
+  unsigned int blockSizes[] = {64, 512};
+  for (int i = 0; i < 2; i += 1)
+    benchMasterBus(blockSizes[i]);
+}
+
+/**
+ * Function: benchMapper
+ * ---------------------
+ * Times getNote and getPosition
+ * across every letter key.
+ */
+void Benchmark::benchMapper() {
+  Mapper mapper; // default scale and mode
+  if (!mapper.init("data/scales.txt", "data/modes.txt")) {
+    cerr << "Skipping mapper benchmark without data files." << endl;
+    return;
+  }
+
+  string keyboard("qwertyuiopasdfghjklzxcvbnm");
+  long iterations = 1000000;
+  volatile int sink = 0; // keep the calls
+
+  unsigned long long start = ofGetElapsedTimeMicros();
+  for (long i = 0; i < iterations; i += 1)
+    sink += mapper.getNote(keyboard[i % 26]);
+  report("mapper_get_note", "26", iterations, ofGetElapsedTimeMicros() - start);
+
+  start = ofGetElapsedTimeMicros();
+  for (long i = 0; i < iterations; i += 1)
+    sink += mapper.getPosition(keyboard[i % 26]);
+  report("mapper_get_position", "26", iterations, ofGetElapsedTimeMicros() - start);
+}
+
+/**
+ * Function: benchScheduler
+ * ------------------------
+ * Times one beat of scheduleLayers over
+ * synthetic 64 beat layers. Uses block
+ * mode so nothing reaches FluidSynth.
+ */
+void Benchmark::benchScheduler(int layerCount, int noteCount) {
+  Synthesizer synth; // never rendered
+  if (!synth.init(44100, 256, false)) return;
+
+  Sequencer seq; // no note handler
+  seq.init(&synth, 120, NULL, NULL, true);
+  int beatCount = 64;
+
+  for (int i = 0; i < layerCount; i += 1) {
+    Layer layer;
+    layer.channel = i % LAYER_CHANNELS; // several per channel past 16
+    layer.beatCount = beatCount;
+
+    // spread notes evenly over the loop
+    for (int j = 0; j < noteCount; j += 1) {
+      int offset = (long long) j * beatCount * TICKS_PER_BEAT / noteCount;
+      Note note = {(float) (48 + j % 24), 100, offset, TICKS_PER_BEAT / 4, j % 26};
+      layer.notes.push_back(note);
+    }
+
+    seq.addLayer(layer);
+  }
+
+  long iterations = 20000;
+  unsigned long long start = ofGetElapsedTimeMicros();
+
+  for (long i = 0; i < iterations; i += 1) {
+    seq.scheduleLayers();
+    seq.pending.clear(); // as if played
+  }
+
+  stringstream parameter; parameter << layerCount << "x" << noteCount;
+  report("sequencer_schedule_layers", parameter.str(), iterations, ofGetElapsedTimeMicros() - start);
+}
+
+/**
+ * Function: benchGraphics
+ * -----------------------
+ * Times creating blocks through the note
+ * handler and then updating all of them.
+ */
+void Benchmark::benchGraphics(int blockCount) {
+  ofApp app; // never drawn
+  app.makeGridStripes();
+
+  unsigned long long start = ofGetElapsedTimeMicros();
+  for (int i = 0; i < blockCount; i += 1) // sequenced channels
+    ofApp::noteHandler(&app, 2 + i % 7, i % 26, 100, i % 2000, 100);
+
+  stringstream parameter; parameter << blockCount;
+  report("app_note_handler", parameter.str(), blockCount, ofGetElapsedTimeMicros() - start);
+
+  long iterations = 2000;
+  start = ofGetElapsedTimeMicros();
+  for (long i = 0; i < iterations; i += 1)
+    app.update();
+
+  report("app_update", parameter.str(), iterations, ofGetElapsedTimeMicros() - start);
+}
+
+/**
+ * Function: benchSynthesis
+ * ------------------------
+ * Times 64 frame renders with a given
+ * number of sustained organ voices.
+ */
+void Benchmark::benchSynthesis(const string fontPath, int polyphony) {
+  Synthesizer synth; // offline
+  if (!synth.init(44100, polyphony, false)) return;
+  if (!synth.load(fontPath.c_str())) {
+    cerr << "Skipping synthesis benchmark without " << fontPath << "." << endl;
+    return;
+  }
+
+  // organs hold notes for as long as we like
+  for (int i = 0; i < 16; i += 1)
+    if (i != 9) synth.setInstrument(i, 19);
+
+  for (int i = 0; i < polyphony; i += 1) {
+    int channel = i % 15; // skip drums
+    if (channel >= 9) channel += 1;
+    synth.noteOn(channel, 36 + i % 60, 100);
+  }
+
+  // let the attacks settle
+  float buffer[2 * 64];
+  for (int i = 0; i < 100; i += 1)
+    synth.synthesize(buffer, 64);
+
+  long iterations = 5000;
+  unsigned long long start = ofGetElapsedTimeMicros();
+  for (long i = 0; i < iterations; i += 1)
+    synth.synthesize(buffer, 64);
+
+  stringstream parameter; parameter << polyphony;
+  report("synth_block_64", parameter.str(), iterations, ofGetElapsedTimeMicros() - start);
+}
+
+/**
+ * Function: benchMasterBus
+ * ------------------------
+ * Times mixing all 16 channels and the
+ * effects at their gains, then the DC
+ * blocker and limiter, for one block.
+ */
+void Benchmark::benchMasterBus(unsigned int numFrames) {
+  MasterBus bus;
+  bus.init(44100);
+
+  // loud enough noise everywhere that the limiter works
+  ChannelBuffers channels;
+  channels.allocate(numFrames);
+  for (int i = 0; i < channels.data.size(); i += 1)
+    channels.data[i] = (rand() % 2001 - 1000) / 2000.0;
+
+  vector<float> buffer(2 * numFrames);
+  unsigned int allChannels = (1u << MASTER_CHANNELS) - 1;
+
+  long iterations = 20000;
+  unsigned long long start = ofGetElapsedTimeMicros();
+  for (long i = 0; i < iterations; i += 1) {
+    bus.mixChannels(&buffer[0], channels, allChannels, numFrames);
+    bus.process(&buffer[0], numFrames);
+  }
+
+  stringstream parameter; parameter << numFrames;
+  report("master_bus", parameter.str(), iterations, ofGetElapsedTimeMicros() - start);
+}
+
+/**
+ * Function: report
+ * ----------------
+ * Writes one CSV result row.
+ */
+void Benchmark::report(const string name, const string parameter,
+  long iterations, unsigned long long micros) {
+  double nsPerOp = 1000.0 * micros / iterations;
+  *out << name << "," << parameter << "," << iterations << ","
+    << micros << "," << nsPerOp << endl;
+}
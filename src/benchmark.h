@@ -0,0 +1,43 @@
+/**
+ * File: benchmark.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Times the note path, scheduler,
+ * graphics update, and synthesis
+ * and reports the results as CSV.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+// microbenchmark runner
+class Benchmark {
+  public:
+    // run every benchmark and write one CSV row each
+    void run(ostream& output, const string fontPath);
+
+  protected:
+    // keypress lookups
+    void benchMapper();
+    // one beat of N layers with M notes each
+    void benchScheduler(int layerCount, int noteCount);
+    // note handler and update with live blocks
+    void benchGraphics(int blockCount);
+    // render throughput at a polyphony level
+    void benchSynthesis(const string fontPath, int polyphony);
+    // mixing every channel and limiting a block
+    void benchMasterBus(unsigned int numFrames);
+
+    // write a result row
+    void report(const string name, const string parameter,
+      long iterations, unsigned long long micros);
+
+    ostream* out;
+};
+
+// guard
+#endif
@@ -0,0 +1,137 @@
+/**
+ * File: blockstore.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Pooled storage for the graphical
+ * blocks on a stripe, kept as flat
+ * arrays in ring buffer order.
+ */
+
+#include "blockstore.h"
+using namespace std;
+
+// enough for a calm stripe
+const unsigned int START_CAPACITY = 64;
+
+/**
+ * Constructor: BlockStore
+ * -----------------------
+ * Allocates the starting pool.
+ */
+BlockStore::BlockStore()
+  : head(0), tail(0), mask(START_CAPACITY - 1) {
+  posFrac.resize(START_CAPACITY);
+  sizeFrac.resize(START_CAPACITY);
+  color.resize(START_CAPACITY);
+  velFrac.resize(START_CAPACITY);
+  finalized.resize(START_CAPACITY);
+  live.resize(START_CAPACITY, false);
+}
+
+/**
+ * Function: add
+ * -------------
+ * Appends a block at the ring tail and
+ * returns a handle that stays valid
+ * until the block is removed.
+ */
+BlockHandle BlockStore::add(const Block& block) {
+  // ring is full [dead blocks behind head do not count]
+  if (tail - head == mask + 1) grow();
+
+  int slot = getSlot(tail);
+  posFrac[slot] = block.posFrac;
+  sizeFrac[slot] = block.sizeFrac;
+  color[slot] = block.color;
+  velFrac[slot] = block.velFrac;
+  finalized[slot] = block.finalized;
+  live[slot] = true;
+
+  return tail++;
+}
+
+/**
+ * Function: remove
+ * ----------------
+ * Frees a block. Blocks mostly leave in the
+ * order they came, so freeing just moves the
+ * head past any run of dead blocks.
+ */
+void BlockStore::remove(BlockHandle handle) {
+  if (!isLive(handle)) return;
+  live[getSlot(handle)] = false;
+
+  while (head != tail && !live[getSlot(head)])
+    head += 1; // reclaim from the front
+}
+
+/**
+ * Function: finalize
+ * ------------------
+ * Stops a free play block from growing
+ * if it is still on the stripe.
+ */
+void BlockStore::finalize(BlockHandle handle) {
+  if (!isLive(handle)) return;
+  finalized[getSlot(handle)] = true;
+}
+
+/**
+ * Function: isLive
+ * ----------------
+ * Checks that a handle is in the ring
+ * and has not been removed. Handles
+ * wrap so the math is on differences.
+ */
+bool BlockStore::isLive(BlockHandle handle) {
+  if (handle - head >= tail - head) return false;
+  return live[getSlot(handle)];
+}
+
+/**
+ * Function: getSlot
+ * -----------------
+ * Maps a handle to its array index.
+ */
+int BlockStore::getSlot(BlockHandle handle) {
+  // capacity is a power of two
+  return handle & mask;
+}
+
+/**
+ * Function: grow
+ * --------------
+ * Doubles the pool and moves every block
+ * to its slot under the new mask, so that
+ * outstanding handles keep working.
+ */
+void BlockStore::grow() {
+  unsigned int capacity = 2 * (mask + 1);
+  unsigned int newMask = capacity - 1;
+
+  vector<float> newPosFrac(capacity);
+  vector<float> newSizeFrac(capacity);
+  vector<ofColor> newColor(capacity);
+  vector<float> newVelFrac(capacity);
+  vector<char> newFinalized(capacity);
+  vector<char> newLive(capacity, false);
+
+  for (BlockHandle handle = head; handle != tail; handle += 1) {
+    int from = handle & mask;
+    int to = handle & newMask;
+    newPosFrac[to] = posFrac[from];
+    newSizeFrac[to] = sizeFrac[from];
+    newColor[to] = color[from];
+    newVelFrac[to] = velFrac[from];
+    newFinalized[to] = finalized[from];
+    newLive[to] = live[from];
+  }
+
+  posFrac.swap(newPosFrac);
+  sizeFrac.swap(newSizeFrac);
+  color.swap(newColor);
+  velFrac.swap(newVelFrac);
+  finalized.swap(newFinalized);
+  live.swap(newLive);
+  mask = newMask;
+}
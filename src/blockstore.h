@@ -0,0 +1,66 @@
+/**
+ * File: blockstore.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Pooled storage for the graphical
+ * blocks on a stripe, kept as flat
+ * arrays in ring buffer order.
+ */
+
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include <vector>
+#include "ofMain.h"
+
+// a block is named by its sequence number,
+// which stays valid while the ring grows
+typedef unsigned int BlockHandle;
+
+// graphical note
+struct Block {
+  float posFrac;
+  float sizeFrac;
+  ofColor color;
+  float velFrac;
+  bool finalized;
+};
+
+// blocks on one stripe
+class BlockStore {
+  public:
+    BlockStore();
+
+    // append a block and get its handle
+    BlockHandle add(const Block& block);
+    // free a block [only advances the ring]
+    void remove(BlockHandle handle);
+    // mark a free play block as released
+    void finalize(BlockHandle handle);
+    // whether the handle still names a block
+    bool isLive(BlockHandle handle);
+
+    // ring position of a handle
+    int getSlot(BlockHandle handle);
+
+    // every handle in [head, tail) that is live
+    // is a block, oldest first [so loop h != tail]
+    BlockHandle head;
+    BlockHandle tail;
+
+    // one array per field for tight loops
+    vector<float> posFrac;
+    vector<float> sizeFrac;
+    vector<ofColor> color;
+    vector<float> velFrac;
+    vector<char> finalized;
+    vector<char> live;
+
+  private:
+    // double capacity and rehome blocks
+    void grow();
+    unsigned int mask;
+};
+
+// guard
+#endif
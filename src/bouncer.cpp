@@ -0,0 +1,321 @@
+/**
+ * File: bouncer.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Renders sequencer layers offline
+ * into WAV files as fast as the
+ * machine allows.
+ */
+
+#include "bouncer.h"
+#include "synthesizer.h"
+#include "sequencer.h"
+#include "sfsubset.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <set>
+using namespace std;
+
+// frames per synthesize call
+const unsigned int BOUNCE_BLOCK = 512;
+// let notes ring out after the last loop
+const int TAIL_SECONDS = 2;
+
+/**
+ * Function: writeLittleEndian
+ * ---------------------------
+ * Writes the low bytes of a value
+ * in WAV [little endian] order.
+ */
+void writeLittleEndian(ofstream& file, unsigned int value, int bytes) {
+  for (int i = 0; i < bytes; i += 1) {
+    file.put((char) (value & 0xFF));
+    value >>= 8; // next byte
+  }
+}
+
+/**
+ * Function: writeWavHeader
+ * ------------------------
+ * Writes a 16 bit stereo PCM header
+ * for a given number of data bytes.
+ */
+void writeWavHeader(ofstream& file, int rate, unsigned int dataBytes) {
+  file.write("RIFF", 4);
+  writeLittleEndian(file, 36 + dataBytes, 4);
+  file.write("WAVEfmt ", 8);
+  writeLittleEndian(file, 16, 4); // chunk size
+  writeLittleEndian(file, 1, 2); // PCM
+  writeLittleEndian(file, 2, 2); // stereo
+  writeLittleEndian(file, rate, 4);
+  writeLittleEndian(file, rate * 4, 4); // bytes per second
+  writeLittleEndian(file, 4, 2); // bytes per frame
+  writeLittleEndian(file, 16, 2); // bits per sample
+  file.write("data", 4);
+  writeLittleEndian(file, dataBytes, 4);
+}
+
+/**
+ * Function: stemPath
+ * ------------------
+ * Names a per channel stem by putting
+ * the channel before the extension.
+ */
+string stemPath(const string path, int channel) {
+  stringstream stem; // take.wav becomes take.ch3.wav
+  size_t dot = path.rfind('.');
+  stem << path.substr(0, dot) << ".ch" << channel;
+  if (dot != string::npos) stem << path.substr(dot);
+  return stem.str();
+}
+
+/**
+ * Constructor: Bouncer
+ * --------------------
+ * Starts with nothing to bounce.
+ */
+Bouncer::Bouncer()
+  : beatsPerMinute(120), sampleRate(44100),
+    renderCount(1), rendersDone(0), progress(0) {}
+
+/**
+ * Function: init
+ * --------------
+ * Sets the soundfont and rate
+ * that every render will use.
+ */
+bool Bouncer::init(const string path, int rate) {
+  if (rate <= 0) return false;
+  fontPath = path;
+  sampleRate = rate;
+  return true;
+}
+
+/**
+ * Function: setLayers
+ * -------------------
+ * Copies the layers to be bounced.
+ */
+void Bouncer::setLayers(const vector<Layer>& newLayers, int beatsMinute) {
+  layers = newLayers;
+  beatsPerMinute = beatsMinute;
+}
+
+/**
+ * Function: setChannelGains
+ * -------------------------
+ * Copies the channel gains to
+ * apply to every render.
+ */
+void Bouncer::setChannelGains(const vector<float>& newGains) {
+  // just a mutator because style
+  gains = newGains;
+}
+
+/**
+ * Function: bounce
+ * ----------------
+ * Renders the full mix and optionally
+ * one stem per audible channel.
+ */
+bool Bouncer::bounce(const string path, int loops, bool stems) {
+  set<int> channels; // audible ones
+  for (int i = 0; i < layers.size(); i += 1)
+    if (stems && !layers[i].muted) channels.insert(layers[i].channel);
+
+  // the mix and then each stem
+  renderCount = 1 + channels.size();
+  rendersDone = 0;
+  progress = 0;
+
+  if (!render(path, loops, -1)) return false;
+  if (!stems) return true;
+
+  // this ugly iterator syntax is unnecesary in C++11, but OpenFrameworks is annoying
+  for (set<int>::iterator iterator = channels.begin(); iterator != channels.end(); iterator++)
+    if (!render(stemPath(path, *iterator), loops, *iterator)) return false;
+  return true;
+}
+
+/**
+ * Function: render
+ * ----------------
+ * Drives a block mode sequencer against a
+ * non-live synth and writes every block out.
+ * The half beat lead in before beat zero is
+ * skipped so the file starts on the beat.
+ */
+bool Bouncer::render(const string path, int loops, int soloChannel) {
+  // sequencer is destroyed first
+  Synthesizer synth;
+  Sequencer seq;
+
+  if (!synth.init(sampleRate, 256, false)) return false;
+  if (!synth.load(fontPath.c_str())) return false;
+
+  // stems keep their level in the mix
+  for (int i = 0; i < gains.size(); i += 1)
+    synth.setChannelGain(i, gains[i]);
+
+  // programs are queued ahead of any note
+  int longestBeats = 0; // sets bounce length
+  vector<Layer> playing;
+
+  for (int i = 0; i < layers.size(); i += 1) {
+    if (layers[i].muted || layers[i].beatCount <= 0) continue;
+    if (soloChannel != -1 && layers[i].channel != soloChannel) continue;
+
+    synth.setInstrument(layers[i].channel, layers[i].program);
+    longestBeats = max(longestBeats, layers[i].beatCount);
+    playing.push_back(layers[i]);
+    playing.back().beatStart = -1;
+  }
+
+  if (longestBeats == 0) {
+    cerr << "Nothing to bounce." << endl;
+    return false;
+  }
+
+  // no note handler since nothing is drawn
+  seq.init(&synth, beatsPerMinute, NULL, NULL, true);
+  for (int i = 0; i < playing.size(); i += 1)
+    seq.addLayer(playing[i]);
+
+  unsigned long long rate = sampleRate;
+  unsigned long long leadIn = rate * 30 / beatsPerMinute;
+  unsigned long long bodyEnd = leadIn + loops * longestBeats * rate * 60 / beatsPerMinute;
+  unsigned long long total = bodyEnd + TAIL_SECONDS * rate;
+
+  // the master limiter delays everything, so skip
+  // that much more and render that much past
+  unsigned long long skip = leadIn + synth.getLatency();
+  total += synth.getLatency();
+
+  ofstream file(path.c_str(), ios::binary);
+  if (!file) {
+    cerr << "Cannot open bounce file: " << path << "." << endl;
+    return false;
+  }
+
+  // sizes are patched in at the end
+  writeWavHeader(file, sampleRate, 0);
+  vector<float> buffer(2 * BOUNCE_BLOCK);
+  vector<short> samples(2 * BOUNCE_BLOCK);
+  unsigned long long rendered = 0;
+
+  while (rendered < total) {
+    // end blocks exactly on the lead in and the last loop
+    unsigned long long boundary = rendered < leadIn ? leadIn : rendered < skip ? skip
+      : rendered < bodyEnd ? bodyEnd : total;
+    unsigned int frames = min((unsigned long long) BOUNCE_BLOCK, boundary - rendered);
+    synth.synthesize(&buffer[0], frames);
+    rendered += frames;
+
+    // stop scheduling and release everything into the tail
+    if (rendered == bodyEnd) {
+      synth.setBlockHandler(NULL, NULL);
+      for (int i = 0; i < playing.size(); i += 1)
+        synth.controlChange(playing[i].channel, 123, 0);
+    }
+
+    if (rendered <= skip) continue;
+    for (int i = 0; i < 2 * frames; i += 1) {
+      float sample = max(-1.0f, min(1.0f, buffer[i]));
+      samples[i] = (short) (sample * 32767);
+    }
+
+    file.write((char*) &samples[0], 4 * frames);
+    progress = (rendersDone + (float) rendered / total) / renderCount;
+  }
+
+  // now the data size is known
+  unsigned int dataBytes = 4 * (total - skip);
+  file.seekp(0);
+  writeWavHeader(file, sampleRate, dataBytes);
+
+  cerr << "Bounced " << (total - skip) / rate << " seconds to " << path << "." << endl;
+  rendersDone += 1;
+  return file.good();
+}
+
+/**
+ * Function: getProgress
+ * ---------------------
+ * Get how far the bounce is.
+ */
+float Bouncer::getProgress() {
+  // just an accessor because style
+  return progress;
+}
+
+/**
+ * Constructor: BounceWorker
+ * -------------------------
+ * Starts with nothing bouncing.
+ */
+BounceWorker::BounceWorker()
+  : loops(1), done(false), succeeded(false) {}
+
+/**
+ * Function: start
+ * ---------------
+ * Copies the layers and starts
+ * the bouncing thread.
+ */
+void BounceWorker::start(const string font, const set<int>& fontPrograms,
+  const vector<Layer>& layers, int beatsPerMinute, const string outPath,
+  int loopCount, const vector<float>& gains) {
+  bouncer.setLayers(layers, beatsPerMinute);
+  bouncer.setChannelGains(gains);
+  fontPath = font;
+  programs = fontPrograms;
+  path = outPath;
+  loops = loopCount;
+
+  done = false;
+  succeeded = false;
+  startThread();
+}
+
+/**
+ * Function: getProgress
+ * ---------------------
+ * Get how far the render is.
+ */
+float BounceWorker::getProgress() {
+  if (done) return 1.0;
+  return bouncer.getProgress();
+}
+
+/**
+ * Function: isDone
+ * ----------------
+ * Whether the bounce has finished.
+ */
+bool BounceWorker::isDone() {
+  // just an accessor because style
+  return done;
+}
+
+/**
+ * Function: didSucceed
+ * --------------------
+ * Whether the file was written.
+ */
+bool BounceWorker::didSucceed() {
+  // just an accessor because style
+  return succeeded;
+}
+
+/**
+ * Function: threadedFunction
+ * --------------------------
+ * Finds the subset [usually already
+ * cached] and runs the whole bounce.
+ */
+void BounceWorker::threadedFunction() {
+  bouncer.init(SoundfontSubset::prepare(fontPath, programs), 44100);
+  succeeded = bouncer.bounce(path, loops, false);
+  done = true;
+}
@@ -0,0 +1,92 @@
+/**
+ * File: bouncer.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Renders sequencer layers offline
+ * into WAV files as fast as the
+ * machine allows.
+ */
+
+#ifndef BOUNCER_H
+#define BOUNCER_H
+
+#include <fstream>
+#include <string>
+#include <set>
+#include <vector>
+#include "layer.h"
+using namespace std;
+
+// 16 bit stereo PCM header [write it with no data
+// first and again once the data size is known]
+void writeWavHeader(ofstream& file, int rate, unsigned int dataBytes);
+
+// offline layer renderer
+class Bouncer {
+  public:
+    Bouncer();
+
+    // soundfont to load and output sampling rate
+    bool init(const string fontPath, int rate);
+
+    // layers to bounce and the tempo they were recorded at
+    void setLayers(const vector<Layer>& layers, int beatsPerMinute);
+    // linear master bus gain by channel [unity past the end]
+    void setChannelGains(const vector<float>& gains);
+
+    // render loops times the longest layer into a stereo WAV, and with
+    // stems also one file per channel named like path.ch3.wav
+    bool bounce(const string path, int loops, bool stems);
+    // zero to one over every file of a bounce [any thread]
+    float getProgress();
+
+  protected:
+    // render one file with either every
+    // channel or one channel [soloChannel]
+    bool render(const string path, int loops, int soloChannel);
+
+    vector<Layer> layers;
+    vector<float> gains;
+    int beatsPerMinute;
+    string fontPath;
+    int sampleRate;
+
+    // files in this bounce and those done
+    int renderCount;
+    int rendersDone;
+    volatile float progress;
+};
+
+// bounces on its own thread so
+// the window keeps drawing
+class BounceWorker : public ofThread {
+  public:
+    BounceWorker();
+
+    // begin a bounce without stems and return at once [with
+    // programs given, from the soundfont subset holding them]
+    void start(const string fontPath, const set<int>& programs,
+      const vector<Layer>& layers, int beatsPerMinute, const string path,
+      int loops, const vector<float>& gains = vector<float>());
+
+    // zero to one over the render
+    float getProgress();
+    bool isDone();
+    bool didSucceed();
+
+  protected:
+    void threadedFunction();
+
+    Bouncer bouncer;
+    string fontPath;
+    set<int> programs;
+    string path;
+    int loops;
+
+    // written here and read by the UI
+    volatile bool done;
+    volatile bool succeeded;
+};
+
+// guard
+#endif
@@ -0,0 +1,260 @@
+/**
+ * File: headless.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Runs the app with no window or
+ * sound card from a script of timed
+ * key events, as fast as it renders.
+ */
+
+#include "headless.h"
+#include "bouncer.h"
+#include "ofApp.h"
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+using namespace std;
+
+// record keys by channel [in ofApp]
+extern string SHIFTS;
+
+// frames per synthesize call
+const unsigned int HEADLESS_BLOCK = 256;
+// graphics updates per second of audio
+const int HEADLESS_UPDATE_RATE = 60;
+// let notes ring out after the last event
+const long long HEADLESS_TAIL_MILLIS = 2000;
+// largest WAV data chunk [about six hours]
+const unsigned long long WAV_LIMIT = 0xFFFFFFFFULL - 36;
+
+/**
+ * Function: compareEvents
+ * -----------------------
+ * Orders events by time alone so
+ * ties keep their script order.
+ */
+bool compareEvents(const ScriptEvent& a, const ScriptEvent& b) {
+  return a.millis < b.millis;
+}
+
+/**
+ * Constructor: Headless
+ * ---------------------
+ * Starts with an empty script.
+ */
+Headless::Headless()
+  : endMillis(0), writing(false), rendered(0), written(0), nextUpdate(0) {}
+
+/**
+ * Function: load
+ * --------------
+ * Reads every line of a script. Blank
+ * lines and # comments are skipped.
+ */
+bool Headless::load(const string path) {
+  ifstream script(path.c_str());
+  if (!script) {
+    cerr << "Cannot open headless script: " << path << "." << endl;
+    return false;
+  }
+
+  events.clear();
+  endMillis = 0;
+  string line;
+
+  for (int lineNumber = 1; getline(script, line); lineNumber += 1)
+    if (!parseLine(line, lineNumber)) return false;
+
+  // the app sees events in time order
+  stable_sort(events.begin(), events.end(), compareEvents);
+  return true;
+}
+
+/**
+ * Function: parseLine
+ * -------------------
+ * Turns one script line into the key
+ * downs and ups the window would send.
+ */
+bool Headless::parseLine(const string line, int lineNumber) {
+  string trimmed = line.substr(0, line.find('#'));
+  stringstream fields(trimmed);
+
+  long long millis;
+  string action;
+  string argument;
+
+  if (!(fields >> millis)) {
+    // nothing but whitespace is fine
+    if (trimmed.find_first_not_of(" \t\r") == string::npos) return true;
+    cerr << "Bad time on script line " << lineNumber << "." << endl;
+    return false;
+  }
+
+  fields >> action >> argument;
+  int key = -1; // for down, up, and press
+
+  if (action == "down" || action == "up" || action == "press") {
+    if (argument == "space") key = ' ';
+    else if (argument.size() == 1) key = argument[0];
+  }
+
+  else if (action == "record") { // channels 3 to 8
+    int channel = atoi(argument.c_str());
+    if (channel >= 3 && channel < 3 + (int) SHIFTS.size()) key = SHIFTS[channel - 3];
+    action = "press";
+  }
+
+  else if (action == "mute") { // 1 is free play
+    int layer = atoi(argument.c_str());
+    if (layer >= 1 && layer <= 8) key = '0' + layer;
+    action = "press";
+  }
+
+  else if (action == "stop") {
+    key = ' '; // space ends recording
+    action = "press";
+  }
+
+  else if (action == "seq") {
+    key = '`'; // toggled on release
+    action = "press";
+  }
+
+  else if (action == "end") {
+    endMillis = max(endMillis, millis);
+    return true;
+  }
+
+  if (key == -1) {
+    cerr << "Bad event on script line " << lineNumber << ": " << trimmed << endl;
+    return false;
+  }
+
+  if (action != "up") addEvent(millis, key, true);
+  if (action != "down") addEvent(millis, key, false);
+  return true;
+}
+
+/**
+ * Function: addEvent
+ * ------------------
+ * Appends one key event.
+ */
+void Headless::addEvent(long long millis, int key, bool down) {
+  ScriptEvent event = {millis, key, down};
+  events.push_back(event);
+  endMillis = max(endMillis, millis + HEADLESS_TAIL_MILLIS);
+}
+
+/**
+ * Function: run
+ * -------------
+ * Sets up a windowless app and replays the
+ * script against it. Script time is audio
+ * time, so a run gives the same frames no
+ * matter how fast the machine renders.
+ */
+bool Headless::run(const string outPath) {
+  ofApp app; // never drawn
+  app.headless = true;
+  app.restoreSession = false;
+  app.setup();
+
+  if (app.synth -> synth == NULL) {
+    cerr << "Headless synth did not start." << endl;
+    return false;
+  }
+
+  writing = !outPath.empty();
+  if (writing) {
+    file.open(outPath.c_str(), ios::binary);
+    if (!file) {
+      cerr << "Cannot open headless output: " << outPath << "." << endl;
+      return false;
+    }
+
+    // sizes are patched in at the end
+    writeWavHeader(file, app.synth -> getSampleRate(), 0);
+  }
+
+  buffer.resize(2 * HEADLESS_BLOCK);
+  samples.resize(2 * HEADLESS_BLOCK);
+  rendered = 0;
+  written = 0;
+  nextUpdate = 0;
+
+  unsigned long long rate = app.synth -> getSampleRate();
+  unsigned long long started = ofGetElapsedTimeMicros();
+
+  for (int i = 0; i < events.size(); i += 1) {
+    renderUntil(app, events[i].millis * rate / 1000);
+    if (events[i].down) app.keyPressed(events[i].key);
+    else app.keyReleased(events[i].key);
+  }
+
+  renderUntil(app, endMillis * rate / 1000);
+  unsigned long long elapsed = ofGetElapsedTimeMicros() - started;
+
+  if (writing) {
+    file.seekp(0); // now the data size is known
+    writeWavHeader(file, rate, min(written, WAV_LIMIT));
+    file.close();
+  }
+
+  // same summaries as the timing overlay
+  Histogram* histograms[] = {&app.keyLatency, &app.beatDrift};
+  string names[] = {"Key to noteon", "Beat drift"};
+  double seconds = (double) rendered / rate;
+
+  cout << "Headless: " << events.size() << " events, " << seconds << " s of audio in "
+    << elapsed / 1000000.0 << " s [" << seconds * 1000000 / max(elapsed, 1ULL) << "x]" << endl;
+  for (int i = 0; i < 2; i += 1)
+    cout << names[i] << ": n " << histograms[i] -> getCount()
+      << ", mean " << histograms[i] -> getMean()
+      << ", p50 " << histograms[i] -> getPercentile(50)
+      << ", p99 " << histograms[i] -> getPercentile(99)
+      << ", max " << histograms[i] -> getMax() << " us" << endl;
+
+  // sequencer first since it holds the synth
+  app.destroySequencer();
+  delete app.synth;
+  app.synth = NULL;
+  return !writing || file.good();
+}
+
+/**
+ * Function: renderUntil
+ * ---------------------
+ * Renders blocks up to a frame, calling
+ * update at the frame rate so graphics
+ * notes are drained and blocks move.
+ */
+void Headless::renderUntil(ofApp& app, unsigned long long frame) {
+  unsigned long long updateFrames = app.synth -> getSampleRate() / HEADLESS_UPDATE_RATE;
+
+  while (rendered < frame) {
+    // end blocks exactly on the target and on updates
+    unsigned long long boundary = min(frame, nextUpdate);
+    if (boundary <= rendered) boundary = frame;
+    unsigned int frames = min((unsigned long long) HEADLESS_BLOCK, boundary - rendered);
+
+    app.synth -> synthesize(&buffer[0], frames);
+    rendered += frames;
+
+    if (rendered >= nextUpdate) {
+      app.update(); // no draw without GL
+      nextUpdate = rendered + updateFrames;
+    }
+
+    // null sink stops here
+    if (!writing) continue;
+    for (int i = 0; i < 2 * frames; i += 1) {
+      float sample = max(-1.0f, min(1.0f, buffer[i]));
+      samples[i] = (short) (sample * 32767);
+    }
+
+    file.write((char*) &samples[0], 4 * frames);
+    written += 4 * frames;
+  }
+}
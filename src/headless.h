@@ -0,0 +1,65 @@
+/**
+ * File: headless.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Runs the app with no window or
+ * sound card from a script of timed
+ * key events, as fast as it renders.
+ */
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+class ofApp;
+
+// one scripted key event
+struct ScriptEvent {
+  long long millis; // from the start
+  int key; // as the window would send it
+  bool down; // press or release
+};
+
+// scripted app runner
+class Headless {
+  public:
+    Headless();
+
+    // read a script where each line is "ms action [argument]"
+    // with actions down, up, and press taking a key [or space],
+    // record taking a channel, mute taking a layer, stop to end
+    // recording, seq to toggle the sequencer, and end to set
+    // the run length [false on a bad line]
+    bool load(const string path);
+
+    // replay the script and render every frame to a WAV, or
+    // nowhere with an empty path [false if anything failed]
+    bool run(const string outPath);
+
+  protected:
+    // parse one line into events
+    bool parseLine(const string line, int lineNumber);
+    void addEvent(long long millis, int key, bool down);
+
+    // render up to a frame and keep graphics moving
+    void renderUntil(ofApp& app, unsigned long long frame);
+
+    vector<ScriptEvent> events;
+    long long endMillis;
+
+    // sink and progress
+    ofstream file;
+    bool writing;
+    unsigned long long rendered;
+    unsigned long long written;
+    unsigned long long nextUpdate;
+    vector<float> buffer;
+    vector<short> samples;
+};
+
+// guard
+#endif
@@ -0,0 +1,137 @@
+/**
+ * File: histogram.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Lock-free timing histogram with
+ * power of two microsecond buckets
+ * that any thread can record into.
+ */
+
+#include "histogram.h"
+using namespace std;
+
+/**
+ * Constructor: Histogram
+ * ----------------------
+ * Starts with no samples.
+ */
+Histogram::Histogram() {
+  reset();
+}
+
+/**
+ * Function: record
+ * ----------------
+ * Adds a sample with atomic increments
+ * so the audio thread never waits.
+ */
+void Histogram::record(unsigned int micros) {
+  __sync_fetch_and_add(&counts[getBucket(micros)], 1);
+  __sync_fetch_and_add(&total, (unsigned long long) micros);
+  __sync_fetch_and_add(&count, 1);
+
+  // raise the maximum unless someone beat us to it
+  unsigned int seen = maximum;
+  while (micros > seen) {
+    if (__sync_bool_compare_and_swap(&maximum, seen, micros)) break;
+    seen = maximum;
+  }
+}
+
+/**
+ * Function: reset
+ * ---------------
+ * Clears every bucket. Samples
+ * recorded meanwhile may be lost.
+ */
+void Histogram::reset() {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1)
+    counts[i] = 0;
+
+  total = 0;
+  count = 0;
+  maximum = 0;
+}
+
+/**
+ * Function: getCount
+ * ------------------
+ * Get the number of samples.
+ */
+unsigned int Histogram::getCount() {
+  // just an accessor because style
+  return count;
+}
+
+/**
+ * Function: getMean
+ * -----------------
+ * Get the mean sample in micros.
+ */
+unsigned int Histogram::getMean() {
+  unsigned int samples = count;
+  if (samples == 0) return 0;
+  return total / samples;
+}
+
+/**
+ * Function: getMax
+ * ----------------
+ * Get the largest sample in micros.
+ */
+unsigned int Histogram::getMax() {
+  // just an accessor because style
+  return maximum;
+}
+
+/**
+ * Function: getPercentile
+ * -----------------------
+ * Get the upper bound of the bucket
+ * that holds a given percentile.
+ */
+unsigned int Histogram::getPercentile(float percent) {
+  unsigned int samples = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1)
+    samples += counts[i];
+  if (samples == 0) return 0;
+
+  unsigned int seen = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1) {
+    seen += counts[i];
+    if (seen >= samples * percent / 100.0)
+      return i == 0 ? 0 : (1u << i) - 1;
+  }
+
+  return maximum;
+}
+
+/**
+ * Function: writeCSV
+ * ------------------
+ * Writes one row per nonempty bucket.
+ */
+void Histogram::writeCSV(ostream& out, const string name) {
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i += 1) {
+    if (counts[i] == 0) continue;
+    unsigned int low = i == 0 ? 0 : 1u << (i - 1);
+    unsigned int high = i == 0 ? 0 : (1u << i) - 1;
+    out << name << "," << low << "," << high << "," << counts[i] << endl;
+  }
+}
+
+/**
+ * Function: getBucket
+ * -------------------
+ * Maps micros to a bucket by the
+ * position of the highest set bit.
+ */
+int Histogram::getBucket(unsigned int micros) {
+  int bucket = 0;
+  while (micros > 0 && bucket < HISTOGRAM_BUCKETS - 1) {
+    micros >>= 1;
+    bucket += 1;
+  }
+
+  return bucket;
+}
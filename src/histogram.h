@@ -0,0 +1,52 @@
+/**
+ * File: histogram.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Lock-free timing histogram with
+ * power of two microsecond buckets
+ * that any thread can record into.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+// enough buckets to pass an hour
+const int HISTOGRAM_BUCKETS = 32;
+
+// timing histogram
+class Histogram {
+  public:
+    Histogram();
+
+    // add a sample [safe from any thread]
+    void record(unsigned int micros);
+    // forget every sample
+    void reset();
+
+    // summaries for display
+    unsigned int getCount();
+    unsigned int getMean();
+    unsigned int getMax();
+    // upper bound of the bucket holding the percentile
+    unsigned int getPercentile(float percent);
+
+    // one row per nonempty bucket: name,low_us,high_us,count
+    void writeCSV(ostream& out, const string name);
+
+  protected:
+    // bucket 0 holds zero and bucket
+    // i holds [2^(i - 1), 2^i) micros
+    int getBucket(unsigned int micros);
+
+    volatile unsigned int counts[HISTOGRAM_BUCKETS];
+    volatile unsigned long long total;
+    volatile unsigned int count;
+    volatile unsigned int maximum;
+};
+
+// guard
+#endif
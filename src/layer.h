@@ -13,8 +13,13 @@
 
 // TODO: use map?
 #include <vector>
+#include "blockstore.h"
 #include "ofMain.h"
 
+// note timing resolution so
+// layers never depend on tempo
+const int TICKS_PER_BEAT = 960;
+
 // TODO: we might want to
 // add graphical parameters
 // or pitch bend to this
@@ -22,8 +27,8 @@ struct Note {
   // the building blocks of layers
   float pitch; // MIDI pitch value
   short velocity; // note hardness
-  int msOffset; // offset from start
-  int msDuration; // note duration
+  int tickOffset; // offset from start
+  int tickDuration; // note duration
   int position; // keyboard position
 };
 
@@ -31,29 +36,28 @@ struct Note {
 // unnecessary without methods
 struct Layer {
   // -1 is a sentinel for paused layers
-  Layer() : muted(false), beatStart(-1) {}
+  Layer() : beatStart(-1), beatCount(0), muted(false), channel(0), program(0) {}
 
   vector<Note> notes; // vector of every layer note
+  vector<int> beatIndex; // first note of each beat [see writeLayer]
   int beatStart; // beat count at which it was enabled
   int beatCount; // number of beats in layer sequence
   bool muted; // whether the layer is audible
   int channel; // what channel to associate with
+  int program; // General MIDI instrument
 };
 
-// graphical note
-struct Block {
-  float posFrac;
-  float sizeFrac;
-  ofColor color;
-  float velFrac;
-  bool finalized;
+// the pair of blocks made for a note
+struct NoteBlocks {
+  int stripes[2]; // stripe indices
+  BlockHandle handles[2];
 };
 
 // yellow street stripes
 struct LayerStripe {
   // each of the color things
   // that appear on the stripes
-  vector<Block*> blocks;
+  BlockStore blocks;
   int lastTime;
 
   bool horizontal;
@@ -0,0 +1,173 @@
+/**
+ * File: layertable.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Flat table of written layers
+ * by slot, with the slots on each
+ * channel and the ones that sound.
+ */
+
+#include "layertable.h"
+#include <algorithm>
+#include <functional>
+using namespace std;
+
+/**
+ * Constructor: LayerTable
+ * -----------------------
+ * Starts with no slots.
+ */
+LayerTable::LayerTable() : layerCount(0) {}
+
+/**
+ * Function: add
+ * -------------
+ * Stores a layer, reusing the lowest
+ * free slot so slots stay dense.
+ */
+int LayerTable::add(const Layer& layer) {
+  if (layer.channel < 0 || layer.channel >= LAYER_CHANNELS) return -1;
+  if (layer.channel == DRUM_CHANNEL) return -1; // would be silent
+
+  int slot = layers.size();
+  if (!freeSlots.empty()) {
+    // kept highest first
+    slot = freeSlots.back();
+    freeSlots.pop_back();
+    layers[slot] = layer;
+    used[slot] = true;
+  }
+
+  else {
+    layers.push_back(layer);
+    used.push_back(true);
+  }
+
+  // every list stays in slot order
+  vector<int>& slots = channelSlots[layer.channel];
+  slots.insert(lower_bound(slots.begin(), slots.end(), slot), slot);
+  if (isAudible(layer)) active.insert(lower_bound(active.begin(), active.end(), slot), slot);
+
+  layerCount += 1;
+  return slot;
+}
+
+/**
+ * Function: remove
+ * ----------------
+ * Frees a slot for reuse.
+ */
+void LayerTable::remove(int slot) {
+  if (get(slot) == NULL) return;
+
+  unlist(channelSlots[layers[slot].channel], slot);
+  unlist(active, slot);
+  layers[slot] = Layer(); // drop the notes
+  used[slot] = false;
+
+  freeSlots.insert(lower_bound(freeSlots.begin(), freeSlots.end(),
+    slot, greater<int>()), slot);
+  layerCount -= 1;
+}
+
+/**
+ * Function: clear
+ * ---------------
+ * Frees every slot.
+ */
+void LayerTable::clear() {
+  layers.clear();
+  used.clear();
+  freeSlots.clear();
+  active.clear();
+
+  for (int i = 0; i < LAYER_CHANNELS; i += 1)
+    channelSlots[i].clear();
+  layerCount = 0;
+}
+
+/**
+ * Function: get
+ * -------------
+ * Get the layer in a slot.
+ */
+Layer* LayerTable::get(int slot) {
+  if (slot < 0 || slot >= (int) layers.size()) return NULL;
+  return used[slot] ? &layers[slot] : NULL;
+}
+
+/**
+ * Function: refresh
+ * -----------------
+ * Moves a slot in or out of the
+ * active list after it changed.
+ */
+void LayerTable::refresh(int slot) {
+  Layer* layer = get(slot);
+  if (layer == NULL) return;
+
+  unlist(active, slot);
+  if (isAudible(*layer)) active.insert(lower_bound(active.begin(), active.end(), slot), slot);
+}
+
+/**
+ * Function: getChannel
+ * --------------------
+ * Get the slots on a channel.
+ */
+const vector<int>& LayerTable::getChannel(int channel) {
+  // out of range channels have no layers
+  static const vector<int> none;
+  if (channel < 0 || channel >= LAYER_CHANNELS) return none;
+  return channelSlots[channel];
+}
+
+/**
+ * Function: getActive
+ * -------------------
+ * Get the slots that can sound.
+ */
+const vector<int>& LayerTable::getActive() {
+  // just an accessor because style
+  return active;
+}
+
+/**
+ * Function: getSlotCount
+ * ----------------------
+ * Get the slots ever used.
+ */
+int LayerTable::getSlotCount() {
+  // just an accessor because style
+  return layers.size();
+}
+
+/**
+ * Function: getLayerCount
+ * -----------------------
+ * Get the layers stored.
+ */
+int LayerTable::getLayerCount() {
+  // just an accessor because style
+  return layerCount;
+}
+
+/**
+ * Function: isAudible
+ * -------------------
+ * Whether a layer can ever sound.
+ */
+bool LayerTable::isAudible(const Layer& layer) {
+  // junk layers have no beats
+  return !layer.muted && layer.beatCount > 0;
+}
+
+/**
+ * Function: unlist
+ * ----------------
+ * Drops a slot from a sorted list.
+ */
+void LayerTable::unlist(vector<int>& slots, int slot) {
+  vector<int>::iterator found = lower_bound(slots.begin(), slots.end(), slot);
+  if (found != slots.end() && *found == slot) slots.erase(found);
+}
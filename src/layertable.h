@@ -0,0 +1,66 @@
+/**
+ * File: layertable.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Flat table of written layers
+ * by slot, with the slots on each
+ * channel and the ones that sound.
+ */
+
+#ifndef LAYERTABLE_H
+#define LAYERTABLE_H
+
+#include <vector>
+#include "layer.h"
+using namespace std;
+
+// MIDI channels layers can play on
+const int LAYER_CHANNELS = 16;
+// General MIDI drums take programs from bank
+// 128, which soundfont subsets leave out
+const int DRUM_CHANNEL = 9;
+
+// written layers by slot
+class LayerTable {
+  public:
+    LayerTable();
+
+    // store a layer in a free slot and return the
+    // slot [-1 if its channel is invalid or drums]
+    int add(const Layer& layer);
+    // free a slot or every slot
+    void remove(int slot);
+    void clear();
+
+    // layer in a slot or NULL if free
+    Layer* get(int slot);
+    // call after muting or unmuting in place
+    void refresh(int slot);
+
+    // slots of every layer on a channel
+    const vector<int>& getChannel(int channel);
+    // slots that can sound [unmuted with
+    // beats] in slot order, so scheduling
+    // never visits the rest
+    const vector<int>& getActive();
+
+    // one past the highest slot ever used
+    int getSlotCount();
+    int getLayerCount();
+
+  protected:
+    // whether a layer belongs in active
+    bool isAudible(const Layer& layer);
+    // drop a slot from a sorted list
+    void unlist(vector<int>& slots, int slot);
+
+    vector<Layer> layers;
+    vector<bool> used;
+    vector<int> freeSlots;
+    vector<int> channelSlots[LAYER_CHANNELS];
+    vector<int> active;
+    int layerCount;
+};
+
+// guard
+#endif
@@ -0,0 +1,143 @@
+/**
+ * File: loader.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Loads a soundfont into a synth on
+ * its own thread so the window comes
+ * up while the samples are read.
+ */
+
+#include "loader.h"
+#include "sfsubset.h"
+#include <stdio.h>
+#include <fstream>
+using namespace std;
+
+// bytes per prefetch read
+const int PREFETCH_CHUNK = 1 << 20;
+// share of the progress bar for reading
+// [the rest is FluidSynth parsing shards]
+const float READ_SHARE = 0.7;
+
+/**
+ * Constructor: SoundfontLoader
+ * ----------------------------
+ * Starts with nothing loading.
+ */
+SoundfontLoader::SoundfontLoader()
+  : synth(NULL), readFraction(0), done(false), succeeded(false) {}
+
+/**
+ * Function: start
+ * ---------------
+ * Starts the loading thread.
+ */
+void SoundfontLoader::start(Synthesizer* target,
+  const string fontPath, const set<int>& fontPrograms) {
+  synth = target;
+  path = fontPath;
+  programs = fontPrograms;
+  readFraction = 0;
+  done = false;
+  succeeded = false;
+  startThread();
+}
+
+/**
+ * Function: getProgress
+ * ---------------------
+ * Reading counts by bytes and
+ * loading by shards finished.
+ */
+float SoundfontLoader::getProgress() {
+  if (done) return 1.0;
+  if (synth == NULL) return 0;
+
+  float loaded = (float) synth -> getLoadedShards() / synth -> getShardCount();
+  return READ_SHARE * readFraction + (1 - READ_SHARE) * loaded;
+}
+
+/**
+ * Function: isDone
+ * ----------------
+ * Whether loading has finished.
+ */
+bool SoundfontLoader::isDone() {
+  // just an accessor because style
+  return done;
+}
+
+/**
+ * Function: didSucceed
+ * --------------------
+ * Whether the soundfont loaded.
+ */
+bool SoundfontLoader::didSucceed() {
+  // just an accessor because style
+  return succeeded;
+}
+
+/**
+ * Function: threadedFunction
+ * --------------------------
+ * Swaps in the subset if there is one,
+ * then reads the file and loads it.
+ */
+void SoundfontLoader::threadedFunction() {
+  // extracting is far cheaper than loading what we skip
+  string fontPath = path;
+  if (!programs.empty()) path = SoundfontSubset::prepare(fontPath, programs);
+
+  if (!prefetch()) {
+    cerr << "Cannot read font file: " << path << "." << endl;
+    done = true;
+    return;
+  }
+
+  succeeded = loadSubset(synth, path, fontPath);
+  done = true;
+}
+
+/**
+ * Static Function: loadSubset
+ * ---------------------------
+ * Loads a subset and falls back to the
+ * whole font. A rejected subset is kept
+ * under the same name on every launch,
+ * so it is deleted to be made again.
+ */
+bool SoundfontLoader::loadSubset(Synthesizer* synth,
+  const string subsetPath, const string fontPath) {
+  if (synth -> load(subsetPath.c_str())) return true;
+  if (subsetPath == fontPath) return false;
+
+  cerr << "Loading the whole font file: " << fontPath << "." << endl;
+  remove(subsetPath.c_str());
+  return synth -> load(fontPath.c_str());
+}
+
+/**
+ * Function: prefetch
+ * ------------------
+ * Reads the whole file in chunks,
+ * counting bytes for progress.
+ */
+bool SoundfontLoader::prefetch() {
+  ifstream file(path.c_str(), ios::binary | ios::ate);
+  if (!file) return false;
+
+  long long size = file.tellg();
+  file.seekg(0);
+  if (size <= 0) return false;
+
+  vector<char> chunk(PREFETCH_CHUNK);
+  long long total = 0;
+
+  while (file.read(&chunk[0], chunk.size()) || file.gcount() > 0) {
+    total += file.gcount();
+    readFraction = (float) total / size;
+  }
+
+  readFraction = 1.0;
+  return true;
+}
@@ -0,0 +1,56 @@
+/**
+ * File: loader.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Loads a soundfont into a synth on
+ * its own thread so the window comes
+ * up while the samples are read.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <set>
+#include <string>
+#include "synthesizer.h"
+using namespace std;
+
+// background soundfont load
+class SoundfontLoader : public ofThread {
+  public:
+    SoundfontLoader();
+
+    // begin loading and return at once [with programs
+    // given, only a subset of the soundfont holding them]
+    void start(Synthesizer* synth, const string path,
+      const set<int>& programs = set<int>());
+
+    // zero to one over reading the file
+    // and then loading every shard
+    float getProgress();
+    bool isDone();
+    bool didSucceed();
+
+    // load a prepared subset, or if FluidSynth rejects it delete
+    // it [so it is extracted again] and load the whole font instead
+    static bool loadSubset(Synthesizer* synth, const string subsetPath,
+      const string fontPath);
+
+  protected:
+    void threadedFunction();
+    // read the file through once so the
+    // shards all parse from the page cache
+    bool prefetch();
+
+    Synthesizer* synth;
+    string path;
+    set<int> programs;
+
+    // written here and read by the UI
+    volatile float readFraction;
+    volatile bool done;
+    volatile bool succeeded;
+};
+
+// guard
+#endif
@@ -6,17 +6,95 @@
  * and runs the windowed app.
  */
 
+#include <string>
+#include <fstream>
 #include "ofMain.h"
 #include "ofApp.h"
 #include "ofAppGlutWindow.h"
+#include "benchmark.h"
+#include "session.h"
+#include "bouncer.h"
+#include "headless.h"
+
+/**
+ * Function: runBenchmarks
+ * -----------------------
+ * Runs the benchmark suite with no window
+ * and writes CSV to a file or stdout.
+ */
+int runBenchmarks(int argc, char* argv[]) {
+  Benchmark benchmark;
+  if (argc < 3) { // no file given
+    benchmark.run(cout, "data/fluid.sf2");
+    return 0;
+  }
+
+  ofstream results(argv[2]);
+  if (!results) {
+    cerr << "Cannot open results file: " << argv[2] << "." << endl;
+    return 1;
+  }
+
+  benchmark.run(results, "data/fluid.sf2");
+  return 0;
+}
+
+/**
+ * Function: runBounce
+ * -------------------
+ * Renders a saved session
+ * to a WAV with no window.
+ */
+int runBounce(int argc, char* argv[]) {
+  if (argc < 4) {
+    cerr << "Usage: Protostripe --bounce session.pss output.wav" << endl;
+    return 1;
+  }
+
+  Session session; // mapped
+  if (!session.load(argv[2])) return 1;
+
+  Bouncer bouncer; // faster than real time
+  bouncer.init("data/fluid.sf2", 44100);
+  bouncer.setLayers(session.getLayers(), session.getBeatsPerMinute());
+  return bouncer.bounce(argv[3], 4, false) ? 0 : 1;
+}
+
+/**
+ * Function: runHeadless
+ * ---------------------
+ * Replays a key script with no window
+ * or sound card into a WAV or nowhere.
+ */
+int runHeadless(int argc, char* argv[]) {
+  if (argc < 3) {
+    cerr << "Usage: Protostripe --headless script.txt [output.wav]" << endl;
+    return 1;
+  }
+
+  Headless headless; // faster than real time
+  if (!headless.load(argv[2])) return 1;
+  return headless.run(argc > 3 ? argv[3] : "") ? 0 : 1;
+}
 
 /**
  * Function: main
  * --------------
  * Sets up OpenFrameworks
  * and runs the window thread.
+ * Usage: Protostripe [--benchmark [results.csv]]
+ *        Protostripe [--bounce session.pss output.wav]
+ *        Protostripe [--headless script.txt [output.wav]]
  */
-int main() {
+int main(int argc, char* argv[]) {
+  // windowless modes first
+  if (argc > 1 && string(argv[1]) == "--benchmark")
+    return runBenchmarks(argc, argv);
+  if (argc > 1 && string(argv[1]) == "--bounce")
+    return runBounce(argc, argv);
+  if (argc > 1 && string(argv[1]) == "--headless")
+    return runHeadless(argc, argv);
+
   // set up the OpenGL context in window
   ofAppGlutWindow window; // mirroring
   ofSetupOpenGL(&window, 1024, 768, OF_WINDOW);
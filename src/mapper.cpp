@@ -21,6 +21,31 @@ using namespace std;
  * a MIDI pitch from the pressed key.
  */
 int Mapper::getNote(int key) {
+  // tables are rebuilt by the setters
+  if (key < 'a' || key > 'z') return 0;
+  return pitchTable[key - 'a'];
+}
+
+/**
+ * Function: getPosition
+ * ---------------------
+ * Get note position based on a
+ * mapping of keyboard to scale.
+ */
+int Mapper::getPosition(int key) {
+  // here we just care about which scale index we are playing
+  if (key < 'a' || key > 'z') return 0;
+  return positionTable[key - 'a']; // always out of 26
+}
+
+/**
+ * Function: buildTables
+ * ---------------------
+ * Expands the current scale, key, and
+ * mode into per letter pitch and scale
+ * position tables.
+ */
+void Mapper::buildTables() {
   vector<int>& scaleNotes = scaleMap[scales[scaleIndex]];
   vector<int>& modeIndices = modeMap[modes[modeIndex]];
   int keyBase = keyMap[keys[keyIndex]];
@@ -33,23 +58,18 @@ int Mapper::getNote(int key) {
       + scaleNotes[i % scaleSize + ((i < 0 && (i % scaleSize)) ? scaleSize : 0)];
 
   // finally find the keyboard location and map position to note
-  int modePos = string("qwertyuiopasdfghjklzxcvbnm").find(key);
-  int outputNote = notesMIDI[modeIndices[modePos]];
+  string keyboard("qwertyuiopasdfghjklzxcvbnm");
+  for (int modePos = 0; modePos < 26; modePos += 1) {
+    int letter = keyboard[modePos] - 'a';
+    int outputNote = notesMIDI[modeIndices[modePos]];
 
-  if (outputNote >= 0 && outputNote <= 127) return outputNote;
-  return (outputNote < 0) ? 0 : 127; // saturated math
-}
+    // saturated math
+    if (outputNote < 0) outputNote = 0;
+    if (outputNote > 127) outputNote = 127;
 
-/**
- * Function: getPosition
- * ---------------------
- * Get note position based on a
- * mapping of keyboard to scale.
- */
-int Mapper::getPosition(int key) {
-  // here we just care about which scale index we are playing
-  int modePos = string("qwertyuiopasdfghjklzxcvbnm").find(key);
-  return modeMap[modes[modeIndex]][modePos]; // always out of 26
+    pitchTable[letter] = outputNote;
+    positionTable[letter] = modeIndices[modePos];
+  }
 }
 
 /**
@@ -121,9 +141,10 @@ bool Mapper::init(const string scaleFileName, const string modeFileName) {
 
   // initialize mapping
   initialized = true;
-  setScaleIndex(0);
-  setKeyIndex(0);
-  setModeIndex(0);
+  scaleIndex = 0;
+  keyIndex = 0;
+  modeIndex = 0;
+  buildTables();
   return true;
 }
 
@@ -169,6 +190,7 @@ const vector<string>& Mapper::getKeys() {
 bool Mapper::setScaleIndex(int index) {
   if (!initialized) return false;
   scaleIndex = index;
+  buildTables();
   return true;
 }
 
@@ -181,6 +203,7 @@ bool Mapper::setScaleIndex(int index) {
 bool Mapper::setModeIndex(int index) {
   if (!initialized) return false;
   modeIndex = index;
+  buildTables();
   return true;
 }
 
@@ -193,5 +216,6 @@ bool Mapper::setModeIndex(int index) {
 bool Mapper::setKeyIndex(int index) {
   if (!initialized) return false;
   keyIndex = index;
+  buildTables();
   return true;
 }
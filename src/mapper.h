@@ -38,6 +38,14 @@ class Mapper {
     bool setModeIndex(int index);
 
   private:
+    // recompute lookups on state change
+    void buildTables();
+
+    // indexed by key - 'a' so that lookups
+    // are a single array read per keypress
+    int pitchTable[26];
+    int positionTable[26];
+
     // map from keys to MIDI
     map<string, int> keyMap;
     vector<string> keys;
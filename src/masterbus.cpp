@@ -0,0 +1,384 @@
+/**
+ * File: masterbus.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Master processing after synthesis:
+ * per channel gain and metering over
+ * the FluidSynth audio groups, then a
+ * DC blocker and look-ahead limiter.
+ */
+
+#include "masterbus.h"
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+using namespace std;
+
+// DC blocker corner [Hz]
+const float DC_CORNER = 10.0;
+// limiter recovery to unity [seconds]
+const float LIMITER_RELEASE = 0.1;
+// just under full scale by default
+const float DEFAULT_CEILING = 0.95;
+// meters publish about every 20 ms [frames]
+const unsigned int METER_WINDOW = 1024;
+
+/**
+ * Function: absolutePeak
+ * ----------------------
+ * Largest magnitude in a buffer
+ * whose length is a multiple of 4.
+ */
+float absolutePeak(const float* samples, unsigned int count) {
+#ifdef __SSE__
+  __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 peaks = _mm_setzero_ps();
+  for (unsigned int i = 0; i < count; i += 4)
+    peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, _mm_loadu_ps(samples + i)));
+
+  float lanes[4]; // across the vector
+  _mm_storeu_ps(lanes, peaks);
+  return max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+#else
+  float peak = 0;
+  for (unsigned int i = 0; i < count; i += 1)
+    peak = max(peak, fabsf(samples[i]));
+  return peak;
+#endif
+}
+
+/**
+ * Function: applyRamp
+ * -------------------
+ * Scales interleaved stereo frames by a gain
+ * moving linearly from start to end, where
+ * the last frame gets exactly end.
+ */
+void applyRamp(float* samples, unsigned int frames, float start, float end) {
+  float step = (end - start) / frames;
+#ifdef __SSE__
+  // two frames [four samples] per vector
+  __m128 gains = _mm_set_ps(start + 2 * step, start + 2 * step, start + step, start + step);
+  __m128 steps = _mm_set1_ps(2 * step);
+  for (unsigned int i = 0; i < 2 * frames; i += 4) {
+    _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), gains));
+    gains = _mm_add_ps(gains, steps);
+  }
+#else
+  for (unsigned int i = 0; i < frames; i += 1) {
+    float gain = start + step * (i + 1);
+    samples[2 * i] *= gain;
+    samples[2 * i + 1] *= gain;
+  }
+#endif
+}
+
+/**
+ * Function: addScaled
+ * -------------------
+ * Adds a scaled stereo pair of planar
+ * buffers into an interleaved buffer,
+ * adding to a sum of squares and a peak
+ * of what was added on the way.
+ */
+void addScaled(float* buffer, const float* left, const float* right,
+  float gain, unsigned int frames, float& squares, float& peak) {
+  unsigned int i = 0;
+#ifdef __SSE__
+  __m128 gains = _mm_set1_ps(gain);
+  __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 sums = _mm_setzero_ps();
+  __m128 peaks = _mm_setzero_ps();
+
+  for (; i + 4 <= frames; i += 4) {
+    __m128 l = _mm_mul_ps(_mm_loadu_ps(left + i), gains);
+    __m128 r = _mm_mul_ps(_mm_loadu_ps(right + i), gains);
+    float* out = buffer + 2 * i; // four frames
+
+    _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_unpacklo_ps(l, r)));
+    _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_unpackhi_ps(l, r)));
+
+    // metering rides along in registers
+    sums = _mm_add_ps(sums, _mm_add_ps(_mm_mul_ps(l, l), _mm_mul_ps(r, r)));
+    peaks = _mm_max_ps(peaks, _mm_max_ps(_mm_andnot_ps(sign, l), _mm_andnot_ps(sign, r)));
+  }
+
+  float lanes[4]; // across the vectors
+  _mm_storeu_ps(lanes, sums);
+  squares += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm_storeu_ps(lanes, peaks);
+  peak = max(peak, max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3])));
+#endif
+
+  // the rest [or all without SSE]
+  for (; i < frames; i += 1) {
+    float l = gain * left[i];
+    float r = gain * right[i];
+    buffer[2 * i] += l;
+    buffer[2 * i + 1] += r;
+
+    squares += l * l + r * r;
+    peak = max(peak, max(fabsf(l), fabsf(r)));
+  }
+}
+
+/**
+ * Function: allocate
+ * ------------------
+ * Points every buffer into one
+ * block of a given frame count.
+ */
+void ChannelBuffers::allocate(unsigned int frames) {
+  data.assign(2 * (MASTER_CHANNELS + MASTER_EFFECTS) * frames, 0);
+  float* next = &data[0];
+
+  for (int i = 0; i < MASTER_CHANNELS; i += 1) {
+    left[i] = next; next += frames;
+    right[i] = next; next += frames;
+  }
+
+  for (int i = 0; i < MASTER_EFFECTS; i += 1) {
+    effectsLeft[i] = next; next += frames;
+    effectsRight[i] = next; next += frames;
+  }
+}
+
+/**
+ * Constructor: MasterBus
+ * ----------------------
+ * Starts at unity on every
+ * channel and at 44.1 kHz.
+ */
+MasterBus::MasterBus() : ceiling(DEFAULT_CEILING) {
+  for (int i = 0; i < MASTER_CHANNELS; i += 1)
+    gains[i] = 1.0;
+  init(44100);
+}
+
+/**
+ * Function: init
+ * --------------
+ * Sets the filter and release
+ * for a rate and resets state.
+ */
+void MasterBus::init(int rate) {
+  if (rate <= 0) rate = 44100;
+  dcPole = 1.0 - 2 * M_PI * DC_CORNER / rate;
+  releaseStep = 1.0 - exp(-(float) LIMITER_BLOCK / (LIMITER_RELEASE * rate));
+  reset();
+}
+
+/**
+ * Function: reset
+ * ---------------
+ * Clears the limiter delay and
+ * the DC blocker history.
+ */
+void MasterBus::reset() {
+  memset(blocks, 0, sizeof(blocks));
+  filling = blocks[0];
+  pending = blocks[1];
+  ready = blocks[2];
+  fill = 0;
+
+  gain = 1.0;
+  pendingGain = 1.0;
+  for (int i = 0; i < 2; i += 1) {
+    lastInput[i] = 0;
+    lastOutput[i] = 0;
+  }
+
+  meterFrames = 0;
+  for (int i = 0; i < MASTER_CHANNELS; i += 1) {
+    meterSquares[i] = 0;
+    meterPeaks[i] = 0;
+    channelRms[i] = 0;
+    channelPeaks[i] = 0;
+  }
+}
+
+/**
+ * Function: setChannelGain
+ * ------------------------
+ * Sets the linear gain of a channel.
+ */
+void MasterBus::setChannelGain(int channel, float newGain) {
+  if (channel < 0 || channel >= MASTER_CHANNELS) return;
+  gains[channel] = max(newGain, 0.0f);
+}
+
+/**
+ * Function: getChannelGain
+ * ------------------------
+ * Get the gain of a channel.
+ */
+float MasterBus::getChannelGain(int channel) {
+  if (channel < 0 || channel >= MASTER_CHANNELS) return 0;
+  return gains[channel];
+}
+
+/**
+ * Function: setCeiling
+ * --------------------
+ * Sets the limiter ceiling.
+ */
+void MasterBus::setCeiling(float newCeiling) {
+  // bounded so gain math never divides by zero
+  ceiling = min(max(newCeiling, 0.01f), 1.0f);
+}
+
+/**
+ * Function: mixChannels
+ * ---------------------
+ * Sums channels at their gains plus the
+ * effect returns, skipping silent gains
+ * and channels outside the mask. Shards
+ * own separate channels so they can all
+ * meter here at once.
+ */
+void MasterBus::mixChannels(float* buffer, const ChannelBuffers& channels,
+  unsigned int channelMask, unsigned int numFrames) {
+  memset(buffer, 0, 2 * numFrames * sizeof(float));
+
+  for (int i = 0; i < MASTER_CHANNELS; i += 1) {
+    if (!(channelMask & (1u << i))) continue;
+    float channelGain = gains[i];
+    if (channelGain == 0) continue;
+    addScaled(buffer, channels.left[i], channels.right[i], channelGain,
+      numFrames, meterSquares[i], meterPeaks[i]);
+  }
+
+  // effects are shared so stay at unity
+  // [and belong to no channel's meter]
+  float squares = 0;
+  float peak = 0;
+  for (int i = 0; i < MASTER_EFFECTS; i += 1)
+    addScaled(buffer, channels.effectsLeft[i], channels.effectsRight[i], 1.0,
+      numFrames, squares, peak);
+}
+
+/**
+ * Function: process
+ * -----------------
+ * Blocks DC on each side, then swaps frames
+ * through the limiter so what goes out is
+ * always two limiter blocks old.
+ */
+void MasterBus::process(float* buffer, unsigned int numFrames) {
+  // every shard has mixed by now
+  publishMeters(numFrames);
+
+  // recursive so one frame at a time
+  for (unsigned int i = 0; i < numFrames; i += 1) {
+    for (int side = 0; side < 2; side += 1) {
+      float input = buffer[2 * i + side];
+      float output = input - lastInput[side] + dcPole * lastOutput[side];
+      lastInput[side] = input;
+      lastOutput[side] = output;
+      buffer[2 * i + side] = output;
+    }
+  }
+
+  // keep silence out of denormals
+  for (int side = 0; side < 2; side += 1)
+    if (fabsf(lastOutput[side]) < 1e-15f) lastOutput[side] = 0;
+
+  unsigned int done = 0;
+  while (done < numFrames) {
+    unsigned int frames = min(numFrames - done, LIMITER_BLOCK - fill);
+    float* samples = buffer + 2 * done;
+
+    // in to the filling block and out from the ready one
+    memcpy(filling + 2 * fill, samples, 2 * frames * sizeof(float));
+    memcpy(samples, ready + 2 * fill, 2 * frames * sizeof(float));
+    fill += frames;
+    done += frames;
+
+    if (fill == LIMITER_BLOCK) {
+      advanceLimiter();
+      fill = 0;
+    }
+  }
+}
+
+/**
+ * Function: publishMeters
+ * -----------------------
+ * Turns the sums into levels once a window
+ * has passed. Each level is a single float
+ * store so readers never see a torn value.
+ */
+void MasterBus::publishMeters(unsigned int numFrames) {
+  meterFrames += numFrames;
+  if (meterFrames < METER_WINDOW) return;
+
+  for (int i = 0; i < MASTER_CHANNELS; i += 1) {
+    channelRms[i] = sqrtf(meterSquares[i] / (2 * meterFrames));
+    channelPeaks[i] = meterPeaks[i];
+    meterSquares[i] = 0;
+    meterPeaks[i] = 0;
+  }
+
+  meterFrames = 0;
+}
+
+/**
+ * Function: getChannelRms
+ * -----------------------
+ * Get the RMS of a channel over
+ * the last meter window.
+ */
+float MasterBus::getChannelRms(int channel) {
+  if (channel < 0 || channel >= MASTER_CHANNELS) return 0;
+  return channelRms[channel];
+}
+
+/**
+ * Function: getChannelPeak
+ * ------------------------
+ * Get the peak of a channel over
+ * the last meter window.
+ */
+float MasterBus::getChannelPeak(int channel) {
+  if (channel < 0 || channel >= MASTER_CHANNELS) return 0;
+  return channelPeaks[channel];
+}
+
+/**
+ * Function: advanceLimiter
+ * ------------------------
+ * With the block after it now known, ramps
+ * the pending block to a gain low enough
+ * for both, so the next peak is already
+ * handled when it arrives. Gain only comes
+ * back up at the release rate.
+ */
+void MasterBus::advanceLimiter() {
+  float peak = absolutePeak(filling, 2 * LIMITER_BLOCK);
+  float needed = peak > ceiling ? ceiling / peak : 1.0;
+
+  float target = min(needed, pendingGain);
+  target = min(target, gain + (1 - gain) * releaseStep);
+  applyRamp(pending, LIMITER_BLOCK, gain, target);
+  gain = target;
+  pendingGain = needed;
+
+  // ready was fully read out
+  float* empty = ready;
+  ready = pending;
+  pending = filling;
+  filling = empty;
+}
+
+/**
+ * Function: getLatency
+ * --------------------
+ * Get the limiter delay.
+ */
+unsigned int MasterBus::getLatency() {
+  // a frame leaves once two blocks have passed
+  return 2 * LIMITER_BLOCK;
+}
@@ -0,0 +1,105 @@
+/**
+ * File: masterbus.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Master processing after synthesis:
+ * per channel gain and metering over
+ * the FluidSynth audio groups, then a
+ * DC blocker and look-ahead limiter.
+ */
+
+#ifndef MASTERBUS_H
+#define MASTERBUS_H
+
+#include <vector>
+using namespace std;
+
+// one audio group per MIDI channel
+const int MASTER_CHANNELS = 16;
+// reverb and chorus come back separately
+const int MASTER_EFFECTS = 2;
+// limiter sees this far ahead [frames]
+const unsigned int LIMITER_BLOCK = 32;
+
+// per channel render targets for one
+// synth [what nwrite_float fills in]
+struct ChannelBuffers {
+  // every buffer in one allocation
+  void allocate(unsigned int frames);
+
+  vector<float> data;
+  float* left[MASTER_CHANNELS];
+  float* right[MASTER_CHANNELS];
+  float* effectsLeft[MASTER_EFFECTS];
+  float* effectsRight[MASTER_EFFECTS];
+};
+
+// gains, DC blocker, and limiter
+class MasterBus {
+  public:
+    MasterBus();
+
+    // rates set the filter and release times
+    void init(int rate);
+    // drop any sound in flight [render thread only]
+    void reset();
+
+    // linear gain for a channel [any thread]
+    void setChannelGain(int channel, float gain);
+    float getChannelGain(int channel);
+    // highest output sample [1.0 is full scale]
+    void setCeiling(float ceiling);
+
+    // mix the given channels [a mask with bit n for channel n] and
+    // the effects into an interleaved stereo buffer [overwrites it]
+    void mixChannels(float* buffer, const ChannelBuffers& channels,
+      unsigned int channelMask, unsigned int numFrames);
+    // block DC and limit an interleaved buffer in place
+    void process(float* buffer, unsigned int numFrames);
+
+    // frames the limiter delays the output
+    unsigned int getLatency();
+
+    // post gain levels of a channel over the last
+    // meter window [linear, safe from any thread]
+    float getChannelRms(int channel);
+    float getChannelPeak(int channel);
+
+  protected:
+    // limit the pending block once the next is in
+    void advanceLimiter();
+    // publish levels once a window is summed
+    void publishMeters(unsigned int numFrames);
+
+    volatile float gains[MASTER_CHANNELS];
+    float ceiling;
+
+    // one pole DC blocker per side
+    float dcPole;
+    float lastInput[2];
+    float lastOutput[2];
+
+    // the pending block goes out scaled while the next
+    // fills, so every peak is seen a block in advance
+    float blocks[3][2 * LIMITER_BLOCK];
+    float* filling;
+    float* pending;
+    float* ready;
+    unsigned int fill;
+
+    // gain reached and what pending needs
+    float gain;
+    float pendingGain;
+    float releaseStep;
+
+    // sums for each channel [only touched by the shard
+    // that owns it] and the levels the UI reads
+    float meterSquares[MASTER_CHANNELS];
+    float meterPeaks[MASTER_CHANNELS];
+    unsigned int meterFrames;
+    volatile float channelRms[MASTER_CHANNELS];
+    volatile float channelPeaks[MASTER_CHANNELS];
+};
+
+// guard
+#endif
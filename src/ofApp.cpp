@@ -12,12 +12,13 @@
 
 #include <math.h>
 #include <stdlib.h>
-#include <sys/time.h>
 #include <fluidsynth.h>
 
 #include "sequencer.h"
+#include "session.h"
 #include "mapper.h"
 #include "layer.h"
+#include "sfsubset.h"
 #include "ofApp.h"
 
 // sampled from a Mondrian
@@ -38,17 +39,33 @@ ofColor BLACK(0, 0, 0);
 
 // number shift keys
 string SHIFTS("#$%^&*");
+// woodblock
+const int METRONOME_PROGRAM = 115;
+
+// block glow from channel levels over
+// this many decibels below full scale
+const float METER_RANGE = 48.0;
+const float METER_FALLOFF = 0.9; // per frame
+const float METER_GLOW = 35.0; // most alpha added
+
+// quiet time after a resize before the
+// font is loaded at the new size [micros]
+const unsigned long long FONT_RELOAD_DELAY = 250000;
+// how long a finished bounce is announced [micros]
+const unsigned long long BOUNCE_NOTICE_MICROS = 3000000;
+// channel gain range and step in dB
+const int MIN_GAIN_DB = -30;
+const int MAX_GAIN_DB = 6;
+const int GAIN_STEP_DB = 1;
 
 /**
- * Function: now
- * -------------
- * Returns the current UNIX time
- * in milliseconds from the epoch.
+ * Function: millisToTicks
+ * -----------------------
+ * Converts a recorded time to
+ * ticks at a given tempo.
  */
-long long now() {
-  struct timeval tp; // from time.h
-  gettimeofday(&tp, NULL); // specified in POSIX
-  return (long long) tp.tv_sec * 1000 + tp.tv_usec / 1000;
+int millisToTicks(long millis, int beatsPerMinute) {
+  return (long long) millis * beatsPerMinute * TICKS_PER_BEAT / 60000;
 }
 
 /**
@@ -96,18 +113,48 @@ void ofApp::setup() {
   // and modified from the OpenFrameworks
   // audio input example
 
-  // ofEnableSmoothing();
-  ofSetVerticalSync(true);
-  ofSetCircleResolution(80);
-  ofBackground(WHITE);
+  if (!headless) { // no GL context otherwise
+    // ofEnableSmoothing();
+    ofSetVerticalSync(true);
+    ofSetCircleResolution(80);
+    ofBackground(WHITE);
+  }
+
+  // headless runs are rendered by the caller
+  // and only the render loop keeps script time
+  if (headless) blockSequencing = true;
 
-  // 256 is polyphony
+  // 256 is polyphony per shard
   synth = new Synthesizer();
-  synth -> init(44100, 256, true);
-  synth -> load("data/fluid.sf2");
+  synth -> init(44100, 256, !headless, synthShards);
+  transport.init(synth); // audio clock
+  if (headless) transport.setSmoothing(false);
+  synth -> setLatencyHistogram(&keyLatency);
 
   // we could add error checking here in the future
   readInstruments("data/instruments.txt", instMap, instruments);
+
+  // every program we can ever play
+  set<int> programs;
+  for (map<string, int>::iterator it = instMap.begin(); it != instMap.end(); ++it)
+    programs.insert(it -> second);
+  programs.insert(METRONOME_PROGRAM);
+
+  // warmed as they load so switches never hitch
+  synth -> setWarmPrograms(programs);
+  if (subsetSoundfont) fontPrograms = programs;
+
+  // scripts need sound from their first event, but the window
+  // comes up while the soundfont loads and everything below
+  // [data files and the font] happens alongside it
+  if (headless) SoundfontLoader::loadSubset(synth,
+    SoundfontSubset::prepare("data/fluid.sf2", fontPrograms), "data/fluid.sf2");
+  else soundfontLoader.start(synth, "data/fluid.sf2", fontPrograms);
+  soundsLoading = !headless;
+
+  // limits on held free play notes
+  voices.setPolyphony(freePlayPolyphony);
+  voices.setStealPolicy(stealPolicy);
   mapper.init("data/scales.txt", "data/modes.txt");
 
   // get UI listing variables
@@ -123,27 +170,42 @@ void ofApp::setup() {
   // set free play channel to starting default instrument
   synth -> setInstrument(1, instMap[instruments[instIndex]]);
 
-  // initialize font to Roboto
-  myFont.loadFont("font.ttf", 10);
-  myFont.setSpaceSize(0.55);
+  if (!headless) {
+    // initialize font to Roboto
+    myFont.loadFont("font.ttf", fontSize);
+    myFont.setSpaceSize(0.55);
+    textCache.setFont(&myFont);
+
+    // batched as plain triangles
+    stripeMesh.setMode(OF_PRIMITIVE_TRIANGLES);
+    blockMesh.setMode(OF_PRIMITIVE_TRIANGLES);
+    stripeMesh.setUsage(GL_STREAM_DRAW);
+    blockMesh.setUsage(GL_STREAM_DRAW);
+  }
 
   // initialize Manhattan
   makeGridStripes();
+
+  // pick up the last saved session
+  if (restoreSession && ofFile::doesFileExist(sessionPath, false))
+    loadSession();
 }
 
 /**
  * Function: noteHandler
  * ---------------------
  * Handles note notifications graphically and
- * returns a vector of new block references.
+ * returns handles to the new blocks.
  */
-vector<Block*> ofApp::noteHandler(void* instance, int channel,
+NoteBlocks ofApp::noteHandler(void* instance, int channel,
   int position, int velocity, int distance, int duration) {
   ofApp* app = (ofApp*) instance; // passed as this
-  int msPerBeat = 60000 / app -> beatsPerMinute;
+  float msPerBeat = 60000.0 / app -> beatsPerMinute;
 
-  // reindex channel from zero
-  channel = channel - 1;
+  // free play is channel 1 and every channel
+  // wraps onto the eight pairs of stripes
+  bool finalized = channel != 1; // free play expands blocks
+  channel = (channel + LAYER_CHANNELS - 1) % 8;
 
   float msScreen = app -> screenSize * msPerBeat * app -> beatsPerMeasure;
   float posFrac = (float) distance / msScreen;
@@ -160,30 +222,17 @@ vector<Block*> ofApp::noteHandler(void* instance, int channel,
 
   ofColor colors[] = {BLUE, RED, BLUE, RED, GRAY};
   ofColor color = colors[position % 5]; // we do not like gray
-  bool finalized = channel != 0; // free play expands blocks
   float velFrac = (float) velocity / 127.0;
   app -> stripeLock.lock();
 
-  Block* blockA = new Block;
-  blockA -> posFrac = posFracDirectedA;
-  blockA -> sizeFrac = sizeFrac;
-  blockA -> finalized = finalized;
-  blockA -> velFrac = velFrac;
-  blockA -> color = color;
-
-  Block* blockB = new Block;
-  blockB -> posFrac = posFracDirectedB;
-  blockB -> sizeFrac = sizeFrac;
-  blockB -> finalized = finalized;
-  blockB -> velFrac = velFrac;
-  blockB -> color = color;
-
-  app -> stripes[channel].blocks.push_back(blockA);
-  app -> stripes[channel + 8].blocks.push_back(blockB);
+  Block blockA = {posFracDirectedA, sizeFrac, color, velFrac, finalized};
+  Block blockB = {posFracDirectedB, sizeFrac, color, velFrac, finalized};
 
-  vector<Block*> newBlocks;
-  newBlocks.push_back(blockA);
-  newBlocks.push_back(blockB);
+  NoteBlocks newBlocks;
+  newBlocks.stripes[0] = channel;
+  newBlocks.stripes[1] = channel + 8;
+  newBlocks.handles[0] = app -> stripes[channel].blocks.add(blockA);
+  newBlocks.handles[1] = app -> stripes[channel + 8].blocks.add(blockB);
 
   // used for finalizing
   app -> stripeLock.unlock();
@@ -198,7 +247,7 @@ vector<Block*> ofApp::noteHandler(void* instance, int channel,
  */
 void ofApp::makeGridStripes() {
   // stripeSizeF is of smaller dimension
-  int now = ofGetElapsedTimeMillis();
+  int now = transport.getMillis();
   float stripeSizeF = 1.0 / 40.0;
   vector<int> vStripeIndices;
   vector<int> hStripeIndices;
@@ -229,7 +278,7 @@ void ofApp::makeGridStripes() {
       bool visible = true; //i < 1 || i > 8;
 
       vStripeIndices.pop_back(); // mark the index as used
-      stripes.push_back({vector<Block*>(), now, false, rand() % 2, posFrac, sizeFrac, visible});
+      stripes.push_back({BlockStore(), now, false, rand() % 2, posFrac, sizeFrac, visible});
     }
 
     else { // draw new horizontal stripe
@@ -240,10 +289,13 @@ void ofApp::makeGridStripes() {
       bool visible = true; //i < 1 || i > 8;
 
       hStripeIndices.pop_back(); // mark the index as used
-      stripes.push_back({vector<Block*>(), now, true, rand() % 2, posFrac, sizeFrac, visible});
+      stripes.push_back({BlockStore(), now, true, rand() % 2, posFrac, sizeFrac, visible});
     }
   }
 
+  // new positions to draw
+  backgroundDirty = true;
+
   // all done
   stripeLock.unlock();
 }
@@ -255,10 +307,43 @@ void ofApp::makeGridStripes() {
  * need more grid stripes or color blocks.
  */
 void ofApp::update() {
-  // get current time in seconds
-  int now = ofGetElapsedTimeMillis();
-  int msPerBeat = 60000 / beatsPerMinute;
-  int speed = screenSize * msPerBeat * beatsPerMeasure;
+  // frame time covers update and draw
+  frameStart = ofGetElapsedTimeMicros();
+
+  // recording converts at the tempo that
+  // plays, which changes on a beat
+  if (seq != NULL) beatsPerMinute = seq -> getBeatsPerMinute();
+
+  // get current time in audio ms
+  int now = transport.getMillis();
+  float msPerBeat = 60000.0 / beatsPerMinute;
+  float speed = screenSize * msPerBeat * beatsPerMeasure;
+
+  // collect blocks for notes scheduled
+  // on the render thread since last time
+  if (seq != NULL) seq -> dispatchNotes();
+
+  // on the GL thread after resizes settle
+  reloadFont();
+
+  // hear about the soundfont once
+  if (soundsLoading && soundfontLoader.isDone()) {
+    soundfontLoader.waitForThread(false);
+    if (!soundfontLoader.didSucceed()) cerr << "Playing without sounds." << endl;
+    soundsLoading = false;
+  }
+
+  // and about the bounce once
+  if (bouncing && bounceWorker.isDone()) {
+    bounceWorker.waitForThread(false);
+    bounceNotice = bounceWorker.didSucceed() ? "Bounced to data/bounce.wav" : "Bounce failed";
+    bounceNoticeTime = ofGetElapsedTimeMicros();
+    bouncing = false;
+  }
+
+  // notices fade out on their own
+  if (!bounceNotice.empty() && ofGetElapsedTimeMicros() - bounceNoticeTime > BOUNCE_NOTICE_MICROS)
+    bounceNotice.clear();
 
   // avoid races
   stripeLock.lock();
@@ -267,39 +352,43 @@ void ofApp::update() {
   for (int i = 0; i < stripes.size(); i += 1) {
     bool forward = stripes[i].forward; // direction
     int diff = now - stripes[i].lastTime; // time difference
+    float step = (float) diff / speed;
+    BlockStore& blocks = stripes[i].blocks;
 
-    for (int j = stripes[i].blocks.size() - 1; j >= 0; j -= 1) {
-      Block* block = stripes[i].blocks[j];
+    // oldest first so removals just advance the ring
+    for (BlockHandle h = blocks.head; h != blocks.tail; h += 1) {
+      int j = blocks.getSlot(h);
+      if (!blocks.live[j]) continue;
+      float& posFrac = blocks.posFrac[j];
+      float& sizeFrac = blocks.sizeFrac[j];
 
       // try to delete block in forward direction
-      if (forward && block -> posFrac > 1.5) {
-        delete stripes[i].blocks[j]; // heap allocated
-        stripes[i].blocks.erase(stripes[i].blocks.begin() + j);
+      if (forward && posFrac > 1.5) {
+        blocks.remove(h); // back to the pool
         continue; // block went off screen and is deleted
       }
 
       // try to delete block in backward direction
-      else if (!forward && block -> posFrac + block -> sizeFrac < -0.5) {
-        delete stripes[i].blocks[j]; // heap allocated
-        stripes[i].blocks.erase(stripes[i].blocks.begin() + j);
+      else if (!forward && posFrac + sizeFrac < -0.5) {
+        blocks.remove(h); // back to the pool
         continue; // block went off screen and is deleted
       }
 
       // for free play, block size becomes
       // larger on a prolonged press
-      if (!block -> finalized) {
+      if (!blocks.finalized[j]) {
         if (forward) // grow before releasing down or right
-          block -> sizeFrac += (float) diff / (float) speed;
+          sizeFrac += step;
 
         else { // release and grow up or left
-          block -> sizeFrac += (float) diff / (float) speed;
-          block -> posFrac -= (float) diff / (float) speed;
+          sizeFrac += step;
+          posFrac -= step;
         }
       }
 
       else { // TODO: should we have per block lastTime values?
-        if (forward) block -> posFrac += (float) diff / (float) speed;
-        else block -> posFrac -= (float) diff / (float) speed;
+        if (forward) posFrac += step;
+        else posFrac -= step;
       }
     }
 
@@ -326,7 +415,7 @@ void ofApp::textOnHorizontal(int index, float posFrac, string text, ofColor colo
   int xPos = posFrac * ofGetWidth();
   int yPos = stripes[index].posFrac * ofGetHeight();
   int yTrans = stripeSizeF * 0.7 * min(ofGetHeight(), ofGetWidth());
-  myFont.drawString(text, xPos, yPos + yTrans);
+  textCache.draw(text, xPos, yPos + yTrans, color);
 }
 
 /**
@@ -344,95 +433,153 @@ void ofApp::numOnVertical(int index, float posFrac, string text, ofColor color)
   int xPos = stripes[index].posFrac * ofGetWidth();
   int yPos = posFrac * ofGetHeight();
   int xTrans = stripeSizeF * 0.3 * min(ofGetHeight(), ofGetWidth());
-  myFont.drawString(text, xPos + xTrans, yPos);
+  textCache.draw(text, xPos + xTrans, yPos, color);
 }
 
 /**
- * Function: draw
- * --------------
- * Draws stripe buffers.
+ * Function: addRect
+ * -----------------
+ * Appends a colored rectangle to a
+ * triangle mesh as two triangles.
  */
-void ofApp::draw() {
-  // portmanteau of prototype and stripe
-  ofSetWindowTitle("Protostripe");
+void addRect(ofMesh& mesh, int x, int y, int width, int height, const ofColor& color) {
+  ofFloatColor meshColor(color);
+  ofVec3f corners[] = {
+    ofVec3f(x, y), ofVec3f(x + width, y), ofVec3f(x + width, y + height),
+    ofVec3f(x, y), ofVec3f(x + width, y + height), ofVec3f(x, y + height)
+  };
+
+  for (int i = 0; i < 6; i += 1) {
+    mesh.addVertex(corners[i]);
+    mesh.addColor(meshColor);
+  }
+}
 
-  // get smaller dimension for drawing stripe widths
-  int smallDim = min(ofGetWidth(), ofGetHeight());
+/**
+ * Function: getStripeColor
+ * ------------------------
+ * Picks the color of a stripe given
+ * the sequencer and recording state.
+ */
+ofColor ofApp::getStripeColor(int index) {
+  // sequencer off or not the free play channel
+  if (seq == NULL && index % 8) return FADED;
+  if (recordingMode && index % 8) return FADED;
+
+  // not recording and enabled
+  if (!recordingMode) return YELLOW;
+
+  // recording and free play
+  int correction = 300; // user error
+  int diff = transport.getMillis() - recordingTime + correction;
+  float beats = diff * beatsPerMinute / 60000.0;
+
+  // count the user down visually
+  if (beats < beatsPerMeasure) {
+    if (beats - floor(beats) < 0.25)
+      return CHARTREUSE;
+    return YELLOW;
+  }
 
-  // avoid races
-  stripeLock.lock();
+  // now capturing notes!
+  return CHARTREUSE;
+}
 
-  // draw all of the grid stripes [layers]
+/**
+ * Function: backgroundChanged
+ * ---------------------------
+ * Builds a key from everything the stripes
+ * and labels show and compares it with the
+ * one last drawn. Both vectors keep their
+ * capacity so this never allocates.
+ */
+bool ofApp::backgroundChanged(int screenWidth, int screenHeight) {
+  backgroundKey.clear();
+  backgroundKey.push_back(screenWidth);
+  backgroundKey.push_back(screenHeight);
+  backgroundKey.push_back(tempoSetting);
+  backgroundKey.push_back(beatsPerMeasure);
+  backgroundKey.push_back(currentVelocity);
+  backgroundKey.push_back(gainChannel);
+  backgroundKey.push_back(getChannelGainDb(gainChannel));
+  backgroundKey.push_back(scaleIndex);
+  backgroundKey.push_back(instIndex);
+  backgroundKey.push_back(keyIndex);
+  backgroundKey.push_back(displayText);
+  backgroundKey.push_back(soundsLoading ? 100 * soundfontLoader.getProgress() : -1);
+  backgroundKey.push_back(bouncing ? 100 * bounceWorker.getProgress() : -1);
+  backgroundKey.push_back(bounceNotice.size());
+
+  // colors move with the sequencer, recording, and countdown
+  for (int i = 0; i < stripes.size(); i += 1) {
+    ofColor color = getStripeColor(i);
+    backgroundKey.push_back(color.getHex() << 8 | color.a);
+  }
+
+  if (!backgroundDirty && backgroundKey == drawnKey) return false;
+  drawnKey.swap(backgroundKey);
+  backgroundDirty = false;
+  return true;
+}
+
+/**
+ * Function: drawBackground
+ * ------------------------
+ * Draws the stripes and their labels
+ * into the background buffer that is
+ * copied to the screen every frame.
+ */
+void ofApp::drawBackground(int screenWidth, int screenHeight) {
+  // allocated again on resize
+  if (background.getWidth() != screenWidth || background.getHeight() != screenHeight)
+    background.allocate(screenWidth, screenHeight, GL_RGBA);
+
+  // same white as the window
+  background.begin();
+  ofClear(WHITE);
+  int smallDim = min(screenWidth, screenHeight);
+  stripeMesh.clear();
+
+  // batch all of the grid stripes [layers]
   for (int i = 0; i < stripes.size(); i += 1) {
     if (!stripes[i].visible) continue;
+    ofColor color = getStripeColor(i);
 
     if (stripes[i].horizontal) { // horizontal stripe
-      int width = ofGetWidth(); // full width
       int height = stripes[i].sizeFrac * smallDim;
-      int x = 0; // start stripe at left
-      int y = stripes[i].posFrac * ofGetHeight();
-
-      // sequencer off or not the free play channel
-      if (seq == NULL && i % 8) ofSetColor(FADED);
-      else if (recordingMode && i % 8) ofSetColor(FADED);
-
-      // recording and free play
-      else if (recordingMode) {
-        int correction = 300; // user error
-        int diff = now() - recordingTime + correction;
-        int msPerBeat = 60000 / beatsPerMinute;
-
-        // count the user down visually
-        if (diff / msPerBeat < beatsPerMeasure) {
-          if (diff % msPerBeat < msPerBeat / 4)
-            ofSetColor(CHARTREUSE);
-          else ofSetColor(YELLOW);
-        }
+      int y = stripes[i].posFrac * screenHeight;
+      addRect(stripeMesh, 0, y, screenWidth, height, color);
+    }
 
-        // now capturing notes!
-        else ofSetColor(CHARTREUSE);
-      }
+    else { // draw a vertical stripe
+      int width = stripes[i].sizeFrac * smallDim;
+      int x = stripes[i].posFrac * screenWidth;
+      addRect(stripeMesh, x, 0, width, screenHeight, color);
+    }
+  }
+
+  // soundfont progress fills the free play stripe
+  float progress = soundfontLoader.getProgress();
+  if (soundsLoading && stripes.size() > 8) {
+    int height = stripes[8].sizeFrac * smallDim;
+    int y = stripes[8].posFrac * screenHeight;
+    addRect(stripeMesh, 0, y, progress * screenWidth, height, CHARTREUSE);
+  }
 
-      // not recording and enabled
-      else ofSetColor(YELLOW);
-      ofRect(x, y, width, height);
+  // one call for every stripe
+  stripeMesh.draw();
 
+  // stripe numbers go on top of the stripes
+  for (int i = 0; i < stripes.size(); i += 1) {
+    if (!stripes[i].visible) continue;
+
+    if (stripes[i].horizontal) { // horizontal stripe
       stringstream index; index << i - 8 + 1;
       float posFrac = stripes[i].forward ? 0.005 : 0.99;
       textOnHorizontal(i, posFrac, index.str(), SHALE);
     }
 
-    else { // draw a vertical stripe
-      int width = stripes[i].sizeFrac * smallDim;
-      int height = ofGetHeight(); // full height
-      int x = stripes[i].posFrac * ofGetWidth();
-      int y = 0; // start stripe at top
-
-      // sequencer off or not the free play channel
-      if (seq == NULL && i % 8) ofSetColor(FADED);
-      else if (recordingMode && i % 8) ofSetColor(FADED);
-
-      // recording and free play
-      else if (recordingMode) {
-        int correction = 300; // user error
-        int diff = now() - recordingTime + correction;
-        int msPerBeat = 60000 / beatsPerMinute;
-
-        // count the user down visually
-        if (diff / msPerBeat < beatsPerMeasure) {
-          if (diff % msPerBeat < msPerBeat / 4)
-            ofSetColor(CHARTREUSE);
-          else ofSetColor(YELLOW);
-        }
-
-        // now capturing notes!
-        else ofSetColor(CHARTREUSE);
-      }
-
-      // not recording and enabled
-      else ofSetColor(YELLOW);
-      ofRect(x, y, width, height);
-
+    else { // vertical stripe
       stringstream index; index << i + 1;
       float posFrac = stripes[i].forward ? 0.02 : 0.995;
       numOnVertical(i, posFrac, index.str(), SHALE);
@@ -442,9 +589,11 @@ void ofApp::draw() {
   stringstream BPM;
   stringstream BPMr;
   stringstream vol;
-  BPM << beatsPerMinute << " BPM";
+  BPM << tempoSetting << " BPM";
   BPMr << beatsPerMeasure << " Beats";
   vol << (int) round(100 * (float) currentVelocity / 127.0);
+  stringstream gain; // channel and trim
+  gain << gainChannel << ": " << getChannelGainDb(gainChannel);
 
   textOnHorizontal(8, 0.85, BPM.str(), BLACK); // conversion above
   textOnHorizontal(9, 0.75, BPMr.str(), BLACK); // conversion above
@@ -453,47 +602,177 @@ void ofApp::draw() {
   textOnHorizontal(12, 0.55, "Instrument: " + instruments[instIndex], BLACK);
   textOnHorizontal(13, 0.35, "Key: " + keys[keyIndex], BLACK);
   textOnHorizontal(14, 0.15, "Protostripe 0.0.2", BLACK);
+  textOnHorizontal(14, 0.45, "Gain " + gain.str() + " dB", BLACK);
   textOnHorizontal(15, 0.65, "By Sanjay Kannan", BLACK);
 
-  // draw all the blocks after to appear above
-  for (int i = 0; i < stripes.size(); i += 1) {
-    if (stripes[i].horizontal) { // on a horizontal stripe
-      for (int j = 0; j < stripes[i].blocks.size(); j += 1) {
-        int width = stripes[i].blocks[j] -> sizeFrac * ofGetWidth();
-        int height = stripes[i].sizeFrac * smallDim;
-        int x = stripes[i].blocks[j] -> posFrac * ofGetWidth();
-        int y = stripes[i].posFrac * ofGetHeight();
-
-        // add transparency if recording or volume low
-        ofColor renderColor = stripes[i].blocks[j] -> color;
-        if (recordingMode && i % 8) renderColor.a *= 1.5;
-        else renderColor.a += 30.0 * stripes[i].blocks[j] -> velFrac;
-
-        ofSetColor(renderColor);
-        ofRect(x, y, width, height);
-      }
+  if (soundsLoading) { // until the soundfont is in
+    stringstream loading; loading << (int) (100 * progress);
+    textOnHorizontal(8, 0.45, "Loading sounds " + loading.str() + "%", BLACK);
+  }
+
+  if (bouncing) { // until the file is written
+    stringstream bounced; bounced << (int) (100 * bounceWorker.getProgress());
+    textOnHorizontal(9, 0.35, "Bouncing " + bounced.str() + "%", BLACK);
+  }
+
+  else if (!bounceNotice.empty())
+    textOnHorizontal(9, 0.35, bounceNotice, BLACK);
+
+  // all done
+  background.end();
+}
+
+/**
+ * Function: updateMeters
+ * ----------------------
+ * Reads each channel's level from the synth
+ * [no locks on either side] and maps it to
+ * zero to one over a decibel range, falling
+ * back slowly so blocks do not flicker.
+ */
+void ofApp::updateMeters() {
+  for (int i = 0; i < 8; i += 1) {
+    // both channels drawn on this stripe pair
+    float rms = max(synth -> getChannelRms(i + 1),
+      synth -> getChannelRms((i + 9) % LAYER_CHANNELS));
+    float level = 0; // silence
+
+    if (rms > 0) {
+      level = (20 * log10(rms) + METER_RANGE) / METER_RANGE;
+      level = ofClamp(level, 0, 1);
     }
 
-    else { // draw a block on a vertical stripe
-      for (int j = 0; j < stripes[i].blocks.size(); j += 1) {
-        int width = stripes[i].sizeFrac * smallDim;
-        int height = stripes[i].blocks[j] -> sizeFrac * ofGetHeight();
-        int x = stripes[i].posFrac * ofGetWidth();
-        int y = stripes[i].blocks[j] -> posFrac * ofGetHeight();
+    meterLevels[i] = max(level, meterLevels[i] * METER_FALLOFF);
+  }
+}
+
+/**
+ * Function: draw
+ * --------------
+ * Draws stripe buffers. The stripes come from
+ * the cached background and blocks go out as
+ * one batched triangle mesh on top of them.
+ */
+void ofApp::draw() {
+  // portmanteau of prototype and stripe
+  ofSetWindowTitle("Protostripe");
 
-        // add transparency if recording or volume low
-        ofColor renderColor = stripes[i].blocks[j] -> color;
-        if (recordingMode && i % 8) renderColor.a *= 1.5;
-        else renderColor.a += 30.0 * stripes[i].blocks[j] -> velFrac;
+  // window size is fixed for the frame
+  int screenWidth = ofGetWidth();
+  int screenHeight = ofGetHeight();
 
-        ofSetColor(renderColor);
-        ofRect(x, y, width, height);
-      }
+  // get smaller dimension for drawing stripe widths
+  int smallDim = min(screenWidth, screenHeight);
+
+  // avoid races
+  stripeLock.lock();
+
+  // stripes and labels are redrawn only when
+  // something they show has changed
+  if (backgroundChanged(screenWidth, screenHeight))
+    drawBackground(screenWidth, screenHeight);
+
+  // already composited over white, so blending
+  // again would count its alpha a second time
+  ofSetColor(WHITE);
+  ofDisableAlphaBlending();
+  background.draw(0, 0);
+  ofEnableAlphaBlending();
+
+  // levels from the audio side
+  updateMeters();
+
+  // clearing keeps the vertex capacity
+  blockMesh.clear();
+
+  // batch all the blocks after to appear above
+  for (int i = 0; i < stripes.size(); i += 1) {
+    BlockStore& blocks = stripes[i].blocks;
+    bool horizontal = stripes[i].horizontal;
+    int stripeSize = stripes[i].sizeFrac * smallDim;
+    int stripePos = stripes[i].posFrac * (horizontal ? screenHeight : screenWidth);
+    int length = horizontal ? screenWidth : screenHeight;
+
+    for (BlockHandle h = blocks.head; h != blocks.tail; h += 1) {
+      int j = blocks.getSlot(h);
+      if (!blocks.live[j]) continue;
+
+      // add transparency if recording or volume low
+      ofColor renderColor = blocks.color[j];
+      if (recordingMode && i % 8) renderColor.a *= 1.5;
+      else renderColor.a += 30.0 * blocks.velFrac[j];
+
+      // and glow with what the channel really sounds like
+      renderColor.a = min(255.0f, renderColor.a + METER_GLOW * meterLevels[i % 8]);
+
+      int blockSize = blocks.sizeFrac[j] * length;
+      int blockPos = blocks.posFrac[j] * length;
+
+      if (horizontal) // on a horizontal stripe
+        addRect(blockMesh, blockPos, stripePos, blockSize, stripeSize, renderColor);
+      else // draw a block on a vertical stripe
+        addRect(blockMesh, stripePos, blockPos, stripeSize, blockSize, renderColor);
     }
   }
 
+  // one call for every block
+  blockMesh.draw();
+
   // all done
   stripeLock.unlock();
+
+  // show timing on top of everything
+  if (displayTiming) drawTiming();
+  frameTimes.record(ofGetElapsedTimeMicros() - frameStart);
+}
+
+/**
+ * Function: drawTiming
+ * --------------------
+ * Draws a summary of each timing
+ * histogram in the top left corner.
+ */
+void ofApp::drawTiming() {
+  Histogram* histograms[] = {&keyLatency, &beatDrift, &frameTimes};
+  string names[] = {"Key to noteon", "Beat drift", "Frame time"};
+  ofSetColor(BLACK);
+
+  for (int i = 0; i < 3; i += 1) {
+    stringstream line; // all in micros
+    line << names[i] << ": n " << histograms[i] -> getCount()
+      << ", mean " << histograms[i] -> getMean()
+      << ", p50 " << histograms[i] -> getPercentile(50)
+      << ", p99 " << histograms[i] -> getPercentile(99)
+      << ", max " << histograms[i] -> getMax() << " us";
+    ofDrawBitmapString(line.str(), 10, 20 + 15 * i);
+  }
+
+  // held keys and the limit
+  stringstream held;
+  held << "Voices: " << voices.getActiveCount()
+    << " of " << voices.getPolyphony() << " [";
+  for (int i = 0; i < VOICE_SLOTS; i += 1) {
+    const Voice& voice = voices.getSlot(i);
+    if (voice.active) held << voice.key;
+  }
+
+  held << "]";
+  ofDrawBitmapString(held.str(), 10, 20 + 15 * 3);
+}
+
+/**
+ * Function: dumpTiming
+ * --------------------
+ * Writes every timing histogram to
+ * a CSV file in the data folder.
+ */
+void ofApp::dumpTiming() {
+  ofstream timing("data/timing.csv");
+  timing << "histogram,low_us,high_us,count" << endl;
+  keyLatency.writeCSV(timing, "key_to_noteon");
+  beatDrift.writeCSV(timing, "beat_drift");
+  frameTimes.writeCSV(timing, "frame_time");
+  cout << "Wrote timing histograms to data/timing.csv." << endl;
 }
 
 /**
@@ -504,24 +783,127 @@ void ofApp::draw() {
  */
 void ofApp::buildSequencer() {
   seq = new Sequencer();
-  seq -> init(synth, beatsPerMinute, &ofApp::noteHandler, this);
+  seq -> init(synth, beatsPerMinute, &ofApp::noteHandler, this, blockSequencing);
+  seq -> setDriftHistogram(&beatDrift);
+  writeMetronome();
+}
 
-  int msPerBeat = 60000 / beatsPerMinute;
-  int duration = msPerBeat / 2;
+/**
+ * Function: writeMetronome
+ * ------------------------
+ * Writes a tick layer for the current
+ * meter and matches the lookahead.
+ */
+void ofApp::writeMetronome() {
+  seq -> setLookahead(lookaheadMeasures * beatsPerMeasure);
+  int duration = TICKS_PER_BEAT / 2;
 
   Layer metronome;
   metronome.channel = 2; // metronome channel
   metronome.beatCount = beatsPerMeasure;
+  metronome.program = METRONOME_PROGRAM;
+
+  // keep the bar line of a playing metronome so
+  // the current bar just takes on the new meter
+  vector<Layer> layers = seq -> getLayers();
+  for (int i = 0; i < layers.size(); i += 1)
+    if (layers[i].channel == 2 && layers[i].beatStart != -1 && layers[i].beatCount > 0) {
+      int beat = seq -> getGlobalBeatCount();
+      int bars = max(beat - layers[i].beatStart, 0) / layers[i].beatCount;
+      metronome.beatStart = layers[i].beatStart + bars * layers[i].beatCount;
+    }
 
-  metronome.notes.push_back({70, 127, 0 * msPerBeat, duration, 0});
+  metronome.notes.push_back({70, 127, 0 * TICKS_PER_BEAT, duration, 0});
   for (int i = 1; i < beatsPerMeasure; i += 1) // subsequent weak beats
-    metronome.notes.push_back({60, 127, i * msPerBeat, duration, 0});
+    metronome.notes.push_back({60, 127, i * TICKS_PER_BEAT, duration, 0});
 
   // play metronome by default
-  synth -> setInstrument(2, 115);
+  synth -> setInstrument(2, metronome.program);
   seq -> writeLayer(2, metronome);
 }
 
+/**
+ * Function: getChannelGainDb
+ * --------------------------
+ * Get a channel's gain on the master
+ * bus in whole dB for the gain keys.
+ */
+int ofApp::getChannelGainDb(int channel) {
+  float gain = synth -> getChannelGain(channel);
+  if (gain <= 0) return MIN_GAIN_DB; // silent
+  return (int) round(20 * log10(gain));
+}
+
+/**
+ * Function: bounceLayers
+ * ----------------------
+ * Renders the current layers offline to a
+ * WAV file in the data folder on a worker,
+ * so the window keeps drawing meanwhile.
+ */
+void ofApp::bounceLayers() {
+  if (seq == NULL || bouncing) return; // nothing written or busy
+  cout << "Bouncing layers to data/bounce.wav." << endl;
+
+  // faster than real time with its own synth
+  vector<float> gains; // as heard here
+  for (int i = 0; i < MASTER_CHANNELS; i += 1)
+    gains.push_back(synth -> getChannelGain(i));
+
+  bounceWorker.start("data/fluid.sf2", fontPrograms, seq -> getLayers(),
+    tempoSetting, "data/bounce.wav", bounceLoops, gains);
+  bounceNotice.clear();
+  bouncing = true;
+}
+
+/**
+ * Function: saveSession
+ * ---------------------
+ * Writes the current layers with
+ * the tempo and meter to disk.
+ */
+void ofApp::saveSession() {
+  if (seq == NULL) return; // nothing written
+  cout << "Saving session to " << sessionPath << "." << endl;
+  Session::save(sessionPath, seq -> getLayers(), tempoSetting, beatsPerMeasure);
+}
+
+/**
+ * Function: loadSession
+ * ---------------------
+ * Replaces the sequencer with one
+ * playing the saved layers at the
+ * saved tempo and meter.
+ */
+void ofApp::loadSession() {
+  Session session; // mapped
+  if (!session.load(sessionPath)) return;
+  cout << "Loading session from " << sessionPath << "." << endl;
+
+  if (seq != NULL) destroySequencer();
+  beatsPerMinute = session.getBeatsPerMinute();
+  tempoSetting = beatsPerMinute;
+  beatsPerMeasure = session.getBeatsPerMeasure();
+  recordingMode = false;
+  recordingChannel = 1;
+
+  // the first saved layer on a channel replaces what
+  // is there [the new metronome] and the rest stack
+  buildSequencer();
+  bool restored[LAYER_CHANNELS] = { false };
+
+  for (int i = 0; i < session.getLayerCount(); i += 1) {
+    Layer layer = session.getLayer(i);
+    if (layer.channel < 0 || layer.channel >= LAYER_CHANNELS) continue;
+    if (layer.channel == DRUM_CHANNEL) continue; // never recorded
+    synth -> setInstrument(layer.channel, layer.program);
+
+    if (restored[layer.channel]) seq -> addLayer(layer);
+    else seq -> writeLayer(layer.channel, layer);
+    restored[layer.channel] = true;
+  }
+}
+
 /**
  * Function: destroySequencer
  * --------------------------
@@ -532,6 +914,8 @@ void ofApp::buildSequencer() {
 void ofApp::destroySequencer() {
   delete seq;
   seq = NULL;
+  // a change may not have landed yet
+  beatsPerMinute = tempoSetting;
 }
 
 /**
@@ -540,17 +924,31 @@ void ofApp::destroySequencer() {
  * Handles key presses.
  */
 void ofApp::keyPressed(int key) {
-  // time signature control with ()
-  if (key == '(' && beatsPerMeasure > 1)
-    if (seq == NULL) beatsPerMeasure -= 1;
-  if (key == ')' && beatsPerMeasure < 24)
-    if (seq == NULL) beatsPerMeasure += 1;
-
-  // tempo control with 90
-  if (key == '9' && beatsPerMinute > 24)
-    if (seq == NULL) beatsPerMinute -= 1;
-  if (key == '0' && beatsPerMinute < 200)
-    if (seq == NULL) beatsPerMinute += 1;
+  // time signature control with () [live
+  // changes rewrite the metronome layer]
+  if (key == '(' && beatsPerMeasure > 1) {
+    beatsPerMeasure -= 1;
+    if (seq != NULL) writeMetronome();
+  }
+
+  if (key == ')' && beatsPerMeasure < MAX_BEATS_PER_MEASURE) {
+    beatsPerMeasure += 1;
+    if (seq != NULL) writeMetronome();
+  }
+
+  // tempo control with 90 [live
+  // changes land on the next beat]
+  if (key == '9' && tempoSetting > MIN_BEATS_PER_MINUTE) {
+    tempoSetting -= 1;
+    if (seq != NULL) seq -> setTempo(tempoSetting);
+    else beatsPerMinute = tempoSetting;
+  }
+
+  if (key == '0' && tempoSetting < MAX_BEATS_PER_MINUTE) {
+    tempoSetting += 1;
+    if (seq != NULL) seq -> setTempo(tempoSetting);
+    else beatsPerMinute = tempoSetting;
+  }
 
   // note velocity control with -=
   if (key == '-' && currentVelocity > 0)
@@ -558,6 +956,14 @@ void ofApp::keyPressed(int key) {
   if (key == '=' && currentVelocity < 127)
     currentVelocity += 1;
 
+  // channel gain control with {} [on the
+  // master bus so it holds across layers]
+  if (key == '{' || key == '}') {
+    int gainDb = getChannelGainDb(gainChannel) + (key == '}' ? GAIN_STEP_DB : -GAIN_STEP_DB);
+    gainDb = max(MIN_GAIN_DB, min(MAX_GAIN_DB, gainDb));
+    synth -> setChannelGain(gainChannel, pow(10.0, gainDb / 20.0));
+  }
+
   // scale setting control with []
   if (key == ';' && scaleIndex > 0)
     mapper.setScaleIndex(--scaleIndex);
@@ -583,9 +989,20 @@ void ofApp::keyPressed(int key) {
     mapper.setModeIndex(++modeIndex);
 
   // assorted graphical keys
-  if (key == '\\') ofToggleFullscreen();
+  if (key == '\\' && !headless) ofToggleFullscreen();
   if (key == '|') displayText = !displayText;
 
+  // export the layers without waiting
+  if (key == '?') bounceLayers();
+
+  // session load and save with <>
+  if (key == '<') loadSession();
+  if (key == '>') saveSession();
+
+  // timing overlay and histogram dump
+  if (key == '~') displayTiming = !displayTiming;
+  if (key == '!') dumpTiming();
+
   // special muting for the free play layer
   if (key == '1') freePlayMuted = !freePlayMuted;
 
@@ -611,18 +1028,31 @@ void ofApp::keyPressed(int key) {
       if (freePlayMuted) return;
 
     // avoid multiple notes for single press
-    if (keyPitches.count(key)) return;
+    Voice* held = voices.find(key);
+    if (held != NULL) {
+      held -> retriggers += 1;
+      return;
+    }
+
+    // make room past the polyphony limit
+    if (voices.isFull()) {
+      Voice* victim = voices.getVictim();
+      if (victim == NULL) return; // refused
+      releaseVoice(victim);
+    }
 
     int pitch = mapper.getNote(key);
     int position = mapper.getPosition(key);
     synth -> noteOn(1, pitch, noteVelocity);
-    keyPitches[key] = pitch; // save start pitch
-    keyPositions[key] = position; // save key position
-    keyVelocities[key] = noteVelocity; // save velocity
-    keyTimes[key] = now(); // save start time
+
+    Voice* voice = voices.start(key);
+    voice -> pitch = pitch; // save start pitch
+    voice -> position = position; // save key position
+    voice -> velocity = noteVelocity; // save velocity
+    voice -> startTime = transport.getMillis(); // save start time
 
     // create unfinalized blocks with zero size
-    keyBlocks[key] = noteHandler(this, 1, position, noteVelocity, 0, 0);
+    voice -> blocks = noteHandler(this, 1, position, noteVelocity, 0, 0);
   }
 }
 
@@ -645,36 +1075,37 @@ void ofApp::keyReleased(int key) {
     cout << "Stopping recording on channel " << recordingChannel << "." << endl;
 
     int beatCount = seq -> getGlobalBeatCount();
-    float msPerBeat = 60000 / beatsPerMinute;
-    long startDiff = now() - recordingTime;
+    float msPerBeat = 60000.0 / beatsPerMinute;
+    long startDiff = transport.getMillis() - recordingTime;
     int startBeatDiff = round(startDiff / msPerBeat);
 
     Layer recorded; recorded.channel = recordingChannel;
     recorded.beatCount = startBeatDiff - beatsPerMeasure;
     recorded.beatStart = beatCount;
+    recorded.program = instMap[instruments[instIndex]];
 
     // add all of the recorded notes to the new layer
     for (int i = 0; i < recordedNotes.size(); i += 1)
       recorded.notes.push_back(recordedNotes[i]);
 
     // start playing the layer immediately on channel
-    int currentInst = instMap[instruments[instIndex]];
-    synth -> setInstrument(recordingChannel, currentInst);
+    synth -> setInstrument(recordingChannel, recorded.program);
     seq -> writeLayer(recordingChannel, recorded);
     recordingMode = false;
     recordingChannel = 1;
   }
 
   // look for characters SHIFT two to eight
-  unsigned int found = SHIFTS.find(key);
+  size_t found = SHIFTS.find(key);
   if (found != string::npos) {
     int channel = found + 3; // starts at SHIFT + 3
     if (seq == NULL) return; // sequencer sanity check
     cout << "Recording notes on channel " << channel << "." << endl;
 
     recordingBeat = seq -> getGlobalBeatCount();
-    recordingTime = now(); // UNIX ms
+    recordingTime = transport.getMillis(); // audio ms
     recordingChannel = channel;
+    gainChannel = channel; // trim what was just played
     recordedNotes.clear();
     recordingMode = true;
   }
@@ -690,50 +1121,60 @@ void ofApp::keyReleased(int key) {
       if (freePlayMuted) return;
 
     // make sure note has started playing
-    if (!keyPitches.count(key)) return;
-
-    // note that pitch may have
-    // actually changed in the
-    // meantime, but we use the
-    // originally scheduled one
-    int pitch = keyPitches[key];
-    int position = keyPositions[key];
-    int velocity = keyVelocities[key];
-    long long currTime = now();
-
-    // build up a note to add to recording layer
-    if (recordingChannel != 1 && recordingMode) {
-      float msPerBeat = 60000 / beatsPerMinute;
-
-      // account for the fact that people
-      // are not perfect in starting
-      int correction = 300;
-
-      int duration = currTime - keyTimes[key];
-      long startDiff = keyTimes[key] - recordingTime;
-      int offset = startDiff - msPerBeat * beatsPerMeasure + correction;
-
-      // countdown done
-      if (offset >= 0) {
-        Note newNote = {pitch, velocity, offset, duration, position};
-        recordedNotes.push_back(newNote);
-      }
+    Voice* voice = voices.find(key);
+    if (voice != NULL) releaseVoice(voice);
+  }
+}
+
+/**
+ * Function: releaseVoice
+ * ----------------------
+ * Ends a held free play note on
+ * release or when it is stolen,
+ * recording it if need be.
+ */
+void ofApp::releaseVoice(Voice* voice) {
+  // note that pitch may have
+  // actually changed in the
+  // meantime, but we use the
+  // originally scheduled one
+  int pitch = voice -> pitch;
+  int position = voice -> position;
+  int velocity = voice -> velocity;
+  long long currTime = transport.getMillis();
+
+  // build up a note to add to recording layer
+  if (recordingChannel != 1 && recordingMode) {
+    float msPerBeat = 60000.0 / beatsPerMinute;
+
+    // account for the fact that people
+    // are not perfect in starting
+    int correction = 300;
+
+    int duration = currTime - voice -> startTime;
+    long startDiff = voice -> startTime - recordingTime;
+    int offset = startDiff - msPerBeat * beatsPerMeasure + correction;
+
+    // countdown done
+    if (offset >= 0) {
+      Note newNote = {pitch, velocity, millisToTicks(offset, beatsPerMinute),
+        millisToTicks(duration, beatsPerMinute), position};
+      recordedNotes.push_back(newNote);
     }
+  }
 
-    // turn the present note off
-    synth -> noteOff(1, pitch);
+  // turn the present note off
+  synth -> noteOff(1, pitch);
 
-    // finalize the note just played on screen
-    for (int i = 0; i < keyBlocks[key].size(); i += 1)
-      keyBlocks[key][i] -> finalized = true;
+  // finalize the note just played on screen
+  NoteBlocks& noteBlocks = voice -> blocks;
+  stripeLock.lock(); // update thread moves them
+  for (int i = 0; i < 2; i += 1)
+    stripes[noteBlocks.stripes[i]].blocks.finalize(noteBlocks.handles[i]);
+  stripeLock.unlock();
 
-    // avoid weird overwriting complications
-    keyVelocities.erase(keyVelocities.find(key));
-    keyPositions.erase(keyPositions.find(key));
-    keyBlocks.erase(keyBlocks.find(key));
-    keyPitches.erase(keyPitches.find(key));
-    keyTimes.erase(keyTimes.find(key));
-  }
+  // slot is free for the next press
+  voices.stop(voice);
 }
 
 /**
@@ -742,7 +1183,30 @@ void ofApp::keyReleased(int key) {
  * Handles window resizing.
  */
 void ofApp::windowResized(int width, int height) {
+  // dragging sends a stream of these so the font
+  // is loaded once the size has settled [in update]
   float scaleFactor = (float) min(width, height) / 768.0;
-  myFont.loadFont("font.ttf", 10 * scaleFactor);
+  pendingFontSize = 10 * scaleFactor;
+  fontReloadTime = ofGetElapsedTimeMicros() + FONT_RELOAD_DELAY;
+  backgroundDirty = true;
+}
+
+/**
+ * Function: reloadFont
+ * --------------------
+ * Loads the font at the size from the last
+ * resize once no resize has come for a bit,
+ * and drops the meshes laid out with it.
+ */
+void ofApp::reloadFont() {
+  if (fontReloadTime == 0 || ofGetElapsedTimeMicros() < fontReloadTime) return;
+  fontReloadTime = 0; // done either way
+
+  if (pendingFontSize < 1 || pendingFontSize == fontSize) return;
+  fontSize = pendingFontSize;
+  myFont.loadFont("font.ttf", fontSize);
   myFont.setSpaceSize(0.55);
+
+  textCache.clear();
+  backgroundDirty = true;
 }
@@ -10,12 +10,23 @@
 #include <vector>
 
 #include "synthesizer.h"
+#include "transport.h"
 #include "sequencer.h"
+#include "histogram.h"
+#include "voicetable.h"
+#include "textcache.h"
+#include "bouncer.h"
+#include "loader.h"
 #include "mapper.h"
 #include "ofMain.h"
 
 // master OpenFrameworks runner
 class ofApp : public ofBaseApp {
+  // builds stripes without a window
+  friend class Benchmark;
+  // drives keys from a script
+  friend class Headless;
+
   public:
     void setup();
     void update();
@@ -27,16 +38,42 @@ class ofApp : public ofBaseApp {
     void windowResized(int width, int height);
 
     // graphics callback from sequencer [to create blocks]
-    static vector<Block*> noteHandler(void* instance, int channel,
+    static NoteBlocks noteHandler(void* instance, int channel,
       int position, int velocity, int distance, int duration);
 
   private:
     // originally by Ge Wang
     Synthesizer* synth = NULL;
     Sequencer* seq = NULL;
-    int beatsPerMinute = 120;
+
+    // soundfont loads while the window is up
+    SoundfontLoader soundfontLoader;
+    bool soundsLoading = false;
+    // load only the presets instruments.txt and the
+    // metronome use [saved layers come from them too]
+    bool subsetSoundfont = true;
+    set<int> fontPrograms; // empty for the full font
+
+    // audio frame clock for recording and
+    // graphics [wall clock until setup]
+    Transport transport;
+    int beatsPerMinute = 120; // as played
+    int tempoSetting = 120; // as keyed in
     int beatsPerMeasure = 4;
 
+    // no window or sound card [set before setup
+    // and the caller renders the synth itself]
+    bool headless = false;
+
+    // sequence inside the audio render loop
+    // instead of on FluidSynth timer events
+    bool blockSequencing = true;
+    // FluidSynth instances that split the
+    // channels and render on separate cores
+    int synthShards = 2;
+    // audio queued this far past the beat
+    int lookaheadMeasures = 1;
+
     // audio state variables
     Mapper mapper; // note maps
     bool freePlayMuted = false;
@@ -46,14 +83,13 @@ class ofApp : public ofBaseApp {
     long recordingTime = 0;
 
     // store to build layers
-    map<char, long> keyTimes;
-    map<char, int> keyPitches;
-    map<char, int> keyPositions;
-    map<char, int> keyVelocities;
     vector<Note> recordedNotes;
 
-    // used to create and finalize blocks
-    map<char, vector<Block*> > keyBlocks;
+    // held free play notes and their blocks
+    VoiceTable voices;
+    int freePlayPolyphony = 10;
+    int stealPolicy = STEAL_OLDEST;
+    void releaseVoice(Voice* voice);
 
     // represent Mondrian as
     // a collection of stripes
@@ -63,6 +99,25 @@ class ofApp : public ofBaseApp {
     int screenSize = 2;
     ofMutex stripeLock;
 
+    // rebuilt every frame and drawn in one call each
+    ofColor getStripeColor(int index);
+    ofVboMesh stripeMesh;
+    ofVboMesh blockMesh;
+
+    // stripes and labels change only on keys, resizes,
+    // and the countdown so they are drawn offscreen
+    bool backgroundChanged(int screenWidth, int screenHeight);
+    void drawBackground(int screenWidth, int screenHeight);
+    vector<int> backgroundKey;
+    vector<int> drawnKey;
+    bool backgroundDirty = true;
+    ofFbo background;
+
+    // channel levels [stripes i and i + 8 show
+    // channel i + 1] smoothed for block glow
+    void updateMeters();
+    float meterLevels[8] = {0};
+
     // for listing in the UI
     map<string, int> instMap;
     vector<string> instruments;
@@ -74,8 +129,15 @@ class ofApp : public ofBaseApp {
     void textOnHorizontal(int index, float posFrac, string text, ofColor color);
     void numOnVertical(int index, float posFrac, string text, ofColor color);
     ofTrueTypeFont myFont;
+    TextCache textCache;
     bool displayText = true;
-    float scaleFactor;
+
+    // font size follows the window but only
+    // reloads once resizing has stopped
+    void reloadFont();
+    int fontSize = 10;
+    int pendingFontSize = 10;
+    unsigned long long fontReloadTime = 0;
 
     // mapping state
     int instIndex;
@@ -85,8 +147,39 @@ class ofApp : public ofBaseApp {
 
     // track volume control
     int currentVelocity = 127;
+    // channel the gain keys trim [the
+    // last recorded, free play first]
+    int gainChannel = 1;
+    int getChannelGainDb(int channel);
 
     // build with metronome
     void buildSequencer();
     void destroySequencer();
+    void writeMetronome();
+
+    // offline export of the layers on a worker
+    // and the result shown once it finishes
+    void bounceLayers();
+    int bounceLoops = 4;
+    BounceWorker bounceWorker;
+    bool bouncing = false;
+    string bounceNotice;
+    unsigned long long bounceNoticeTime = 0;
+
+    // binary session of every layer
+    void saveSession();
+    void loadSession();
+    string sessionPath = "data/session.pss";
+    bool restoreSession = true;
+
+    // latency and jitter in micros
+    Histogram keyLatency;
+    Histogram beatDrift;
+    Histogram frameTimes;
+    unsigned long long frameStart = 0;
+
+    // overlay and CSV dump
+    bool displayTiming = false;
+    void drawTiming();
+    void dumpTiming();
 };
@@ -0,0 +1,143 @@
+/**
+ * File: ringbuffer.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * A bounded lock-free ring buffer that
+ * lets any number of producer threads
+ * hand small messages to one consumer
+ * thread without ever taking a mutex.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+// our access to C++11 [and so std::atomic] is
+// not guaranteed, so this uses the GCC builtins
+// that both GCC and Clang have supported forever
+
+// MPSC message queue
+template <typename T>
+class RingBuffer {
+  public:
+    // capacity gets rounded up to a power of two
+    RingBuffer(unsigned int capacity);
+    ~RingBuffer();
+
+    // enqueue an item from any thread and
+    // return false if the buffer is full
+    bool push(const T& item);
+
+    // dequeue an item on the single consumer
+    // thread and return false if none waiting
+    bool pop(T& item);
+
+  private:
+    // each slot carries a sequence number that says
+    // whether it is free for the producer claiming
+    // position n [n] or ready for the consumer [n + 1]
+    struct Slot {
+      volatile unsigned int sequence;
+      T item;
+    };
+
+    Slot* slots;
+    unsigned int mask;
+
+    // claimed by producers
+    volatile unsigned int head;
+    // owned by the consumer
+    unsigned int tail;
+
+    // copying would share slots
+    RingBuffer(const RingBuffer&);
+    RingBuffer& operator=(const RingBuffer&);
+};
+
+/**
+ * Constructor: RingBuffer
+ * -----------------------
+ * Allocates every slot up front so
+ * that pushing never allocates.
+ */
+template <typename T>
+RingBuffer<T>::RingBuffer(unsigned int capacity)
+  : head(0), tail(0) {
+  unsigned int size = 2;
+  while (size < capacity) size <<= 1;
+  mask = size - 1; // cheap modulo
+
+  slots = new Slot[size];
+  for (unsigned int i = 0; i < size; i += 1)
+    slots[i].sequence = i; // all free
+}
+
+/**
+ * Destructor: RingBuffer
+ * ----------------------
+ * Frees the slot array.
+ */
+template <typename T>
+RingBuffer<T>::~RingBuffer() {
+  delete[] slots;
+}
+
+/**
+ * Function: push
+ * --------------
+ * Claims the next free slot with a single
+ * compare and swap and publishes the item.
+ */
+template <typename T>
+bool RingBuffer<T>::push(const T& item) {
+  unsigned int pos = head;
+  Slot* slot;
+
+  while (true) {
+    slot = &slots[pos & mask];
+    unsigned int sequence = slot -> sequence;
+    __sync_synchronize(); // read sequence first
+    int diff = (int) (sequence - pos);
+
+    if (diff == 0) { // slot is free so try to claim it
+      if (__sync_bool_compare_and_swap(&head, pos, pos + 1)) break;
+      pos = head; // another producer won
+    }
+
+    // consumer has not caught up
+    else if (diff < 0) return false;
+    else pos = head; // stale position
+  }
+
+  // write the item before handing it over
+  slot -> item = item;
+  __sync_synchronize();
+  slot -> sequence = pos + 1;
+  return true;
+}
+
+/**
+ * Function: pop
+ * -------------
+ * Takes the oldest published item. Must
+ * only be called from one thread.
+ */
+template <typename T>
+bool RingBuffer<T>::pop(T& item) {
+  Slot* slot = &slots[tail & mask];
+  unsigned int sequence = slot -> sequence;
+  __sync_synchronize(); // read sequence first
+
+  // nothing has been published here yet
+  if ((int) (sequence - (tail + 1)) < 0)
+    return false;
+
+  // read the item before freeing the slot
+  item = slot -> item;
+  __sync_synchronize();
+  slot -> sequence = tail + mask + 1;
+  tail += 1;
+  return true;
+}
+
+// guard
+#endif
@@ -8,15 +8,35 @@
 
 #include "sequencer.h"
 #include "layer.h"
+#include <algorithm>
 using namespace std;
 
+// note edges waiting in block mode
+const unsigned int PENDING_CAPACITY = 4096;
+// graphics notes waiting for the UI thread
+const unsigned int NOTICE_CAPACITY = 1024;
+
+/**
+ * Function: noteBefore
+ * --------------------
+ * Orders notes by start time.
+ */
+bool noteBefore(const Note& first, const Note& second) {
+  return first.tickOffset < second.tickOffset;
+}
+
 /**
  * Constructor: Sequencer
  * ------------------------
  * Sets FluidSynth object to NULL.
  */
 Sequencer::Sequencer()
-  : sequencer(NULL) {}
+  : globalBeatCount(-1), audioBeatCount(-1), lookaheadBeats(0), nextTempo(0), sequencer(NULL),
+    fluid(NULL), batchSize(0), driftHistogram(NULL), blockMode(false), notices(NOTICE_CAPACITY) {
+  // never grows on the render thread
+  pending.reserve(PENDING_CAPACITY);
+  dirtyChannels.reserve(16);
+}
 
 /**
  * Destructor: Sequencer
@@ -24,18 +44,26 @@ Sequencer::Sequencer()
  * Cleans up FluidSynth object.
  */
 Sequencer::~Sequencer() {
+  // waits out a render block in progress
+  if (blockMode) fluid -> setBlockHandler(NULL, NULL);
+
   // lock sequencer
   seqLock.lock();
 
-  // this ugly iterator syntax is unnecesary in C++11, but OpenFrameworks is annoying
-  for (itType iterator = channels.begin(); iterator != channels.end(); iterator++)
-    fluid -> allNotesOff(iterator -> first); // avoid shadow notes
+  for (int i = 0; i < LAYER_CHANNELS; i += 1)
+    if (!layers.getChannel(i).empty())
+      fluid -> allNotesOff(i); // avoid shadow notes
 
   // clean up FluidSynth sequencer object
   if (sequencer) delete_fluid_sequencer(sequencer);
   cerr << "Deleting sequencer object." << endl;
   sequencer = NULL;
 
+  // and the pooled events
+  for (int i = 0; i < eventPool.size(); i += 1)
+    delete_fluid_event(eventPool[i]);
+  eventPool.clear();
+
   // unlock sequencer
   seqLock.unlock();
 }
@@ -46,7 +74,8 @@ Sequencer::~Sequencer() {
  * Sets sequencer synth and
  * sequencer running tempo.
  */
-bool Sequencer::init(Synthesizer* synth, int beatsMinute, NoteHandler call, void* data) {
+bool Sequencer::init(Synthesizer* synth, int beatsMinute,
+  NoteHandler call, void* data, bool inBlocks) {
   // synth sanity check
   if (synth -> synth == NULL) {
     // do not attach sequencer to invalid synth object
@@ -55,7 +84,7 @@ bool Sequencer::init(Synthesizer* synth, int beatsMinute, NoteHandler call, void
   }
 
   // null sanity check
-  if (sequencer != NULL) {
+  if (fluid != NULL) {
     // check if sequencer has already been initialized
     cerr << "Sequencer already initialized." << endl;
     return false;
@@ -68,88 +97,341 @@ bool Sequencer::init(Synthesizer* synth, int beatsMinute, NoteHandler call, void
   cerr << "Initializing sequencer object." << endl;
 
   beatsPerMinute = beatsMinute;
-  msPerBeat = 60000 / beatsPerMinute;
+  globalBeatCount = -1; // start in advance
+  audioBeatCount = -1; // nothing out yet
+  handler = call; // register note handler
+  callData = data; // with custom data
+  fluid = synth;
+
+  if (inBlocks) {
+    // beat zero lands half a beat from now just like in timer
+    // mode, and the render thread does the scheduling from here
+    blockMode = true;
+    transport.init(fluid);
+    transport.setTempo(beatsPerMinute);
+    transport.setOrigin(fluid -> getFrameCount());
+    fluid -> setBlockHandler(&Sequencer::blockCallback, this);
+
+    // unlock sequencer
+    seqLock.unlock();
+    return true;
+  }
 
   // initialize the sequencer itself
   sequencer = new_fluid_sequencer();
 
-  // lock synth
-  fluid = synth;
-  fluid -> synthLock.lock();
-
-  // register the synth with the sequencer [or is it the other way around]
-  synthSeqID = fluid_sequencer_register_fluidsynth(sequencer, fluid -> synth);
+  // notes come back through us so they reach whichever synth shard owns the channel
+  synthSeqID = fluid_sequencer_register_client(sequencer, "synth", &Sequencer::synthCallback, this);
   mySeqID = fluid_sequencer_register_client(sequencer, "this", &Sequencer::callback, this);
 
-  // unlock synth
-  fluid -> synthLock.unlock();
-
+  // source only clients [no callback]
+  for (int i = 0; i < 16; i += 1)
+    channelSeqIDs[i] = fluid_sequencer_register_client(sequencer, "channel", NULL, NULL);
   now = fluid_sequencer_get_tick(sequencer);
-  globalBeatCount = -1; // start in advance
-  handler = call; // register note handler
-  callData = data; // with custom data
-  scheduleLayers(); // schedule note layers
 
-  // unlock sequencer
+  // same beat grid over FluidSynth ms ticks
+  transport.init(1000);
+  transport.setTempo(beatsPerMinute);
+  transport.setOrigin(now);
+
+  // unlock sequencer [flushEvents takes it]
   seqLock.unlock();
+
+  layerLock.lock(); // hold layers steady
+  scheduleLayers(); // schedule note layers
+  layerLock.unlock();
   return sequencer != NULL;
 }
 
 /**
  * Function: scheduleLayers
  * ------------------------
- * Schedules all layers before a beat. Notes
- * are very lazily scheduled at the beat in
- * which they first appear.
+ * Runs half a beat before each beat. Tells
+ * the graphics about that beat and queues
+ * audio through the lookahead.
  */
 void Sequencer::scheduleLayers() {
+  // tempo changes land on the next beat and
+  // whatever was queued past this one is redone
+  if (nextTempo != 0) {
+    retractAhead();
+    beatsPerMinute = nextTempo;
+    transport.changeTempo(beatsPerMinute, 2 * globalBeatCount + 3, 2);
+    nextTempo = 0;
+  }
+
   // staggering half beat behind
-  now = now + msPerBeat / 2;
   globalBeatCount += 1;
+  if (!blockMode) now = getHalfBeatFrame(2 * globalBeatCount + 1);
 
   // useful logging code if callbacks are failing:
   // cout << "Beat to occur at " << now << "." << endl;
 
-  // this ugly iterator syntax is unnecesary in C++11, but OpenFrameworks is annoying
-  for (itType iterator = channels.begin(); iterator != channels.end(); iterator++) {
-    Layer* current = &channels[iterator -> first];
-    int channel = current -> channel;
-    int beatStart = current -> beatStart;
-    int beatCount = current -> beatCount;
+  // only layers that can sound are ever visited
+  const vector<int>& active = layers.getActive();
 
-    // skip muted layers
-    if (current -> muted)
-      continue;
+  // graphics only if the audio for this beat went out earlier
+  if (audioBeatCount >= globalBeatCount)
+    for (int i = 0; i < (int) active.size(); i += 1)
+      scheduleBeat(layers.get(active[i]), globalBeatCount, false, true);
 
-    // junk layer created
-    if (beatCount == 0)
-      continue;
+  // audio runs the lookahead past the graphics, but in block mode it stops
+  // early once pending is half full so dense layers only lose the head start
+  while (audioBeatCount < globalBeatCount + lookaheadBeats) {
+    int beat = audioBeatCount + 1; // next without audio
+    if (blockMode && beat > globalBeatCount && pending.size() > PENDING_CAPACITY / 2)
+      break;
 
-    // remember when we
-    // started this layer
-    if (beatStart == -1) // never forget
-      current -> beatStart = globalBeatCount;
-
-    // see which measure of the layer we are on and calculate time offset
-    int beatPos = (globalBeatCount - current -> beatStart) % beatCount;
-    int beatPosDiff = msPerBeat * beatPos;
-
-    // advance schedule all of the notes in layer
-    for (int i = 0; i < current -> notes.size(); i += 1) {
-      Note note = current -> notes[i]; // iterate through each note in vector
-      if (note.msOffset < beatPosDiff || note.msOffset >= beatPosDiff + msPerBeat)
-        continue; // continue if the note has been or is not ready to be scheduled
-      sendNoteOn(channel, note.pitch, note.velocity, now + note.msOffset - beatPosDiff);
-      sendNoteOff(channel, note.pitch, now + note.msOffset - beatPosDiff + note.msDuration);
-
-      // notify graphics handler of notes in layer on demand like audio
-      int distFromRealNow = note.msOffset - beatPosDiff + msPerBeat / 2;
-      handler(callData, channel, note.position, note.velocity, distFromRealNow, note.msDuration);
-    }
+    for (int i = 0; i < (int) active.size(); i += 1)
+      scheduleBeat(layers.get(active[i]), beat, true, beat == globalBeatCount);
+    audioBeatCount = beat;
   }
 
   // see below
-  scheduleTimer();
+  if (!blockMode) {
+    scheduleTimer();
+    flushEvents();
+  }
+}
+
+/**
+ * Function: scheduleBeat
+ * ----------------------
+ * Schedules the notes of one beat of a
+ * layer. Notes are very lazily scheduled
+ * at the beat in which they first appear.
+ */
+void Sequencer::scheduleBeat(Layer* layer, int beat, bool audio, bool notify) {
+  // skip muted layers
+  if (layer -> muted)
+    return;
+
+  // junk layer created
+  if (layer -> beatCount <= 0)
+    return;
+
+  // remember when we
+  // started this layer
+  if (layer -> beatStart == -1) { // never forget
+    if (!audio) return; // not started yet
+    layer -> beatStart = beat;
+  }
+
+  // written for a later beat
+  if (beat < layer -> beatStart)
+    return;
+
+  // see which measure of the layer we are on and calculate time offset
+  int beatPos = (beat - layer -> beatStart) % layer -> beatCount;
+  int beatPosDiff = beatPos * TICKS_PER_BEAT;
+
+  // advance schedule just the notes in this beat of the layer
+  int first = layer -> beatIndex[beatPos];
+  int last = layer -> beatIndex[beatPos + 1];
+
+  for (int i = first; i < last; i += 1) {
+    const Note& note = layer -> notes[i];
+    if (audio) scheduleNote(layer -> channel, note, beat - beatPos);
+    if (notify) notifyNote(layer -> channel, note, note.tickOffset - beatPosDiff);
+  }
+}
+
+/**
+ * Function: scheduleNote
+ * ----------------------
+ * Schedules both edges of a note from
+ * the pass of its layer that started at
+ * loopBeat. Ticks become time only here
+ * and count from that exact beat.
+ */
+void Sequencer::scheduleNote(int channel, const Note& note, int loopBeat) {
+  // pending events remember the beat the note falls in
+  int beat = loopBeat + note.tickOffset / TICKS_PER_BEAT;
+
+  // positions in half ticks since beats start on odd half beats
+  long long start = (2LL * loopBeat + 1) * TICKS_PER_BEAT + 2LL * note.tickOffset;
+  long long end = start + 2LL * note.tickDuration;
+  unsigned long long onFrame = transport.getFrameAt(start, 2 * TICKS_PER_BEAT);
+  unsigned long long offFrame = transport.getFrameAt(end, 2 * TICKS_PER_BEAT);
+
+  if (!blockMode) { // FluidSynth ms ticks
+    sendNoteOn(channel, note.pitch, note.velocity, onFrame);
+    sendNoteOff(channel, note.pitch, offFrame);
+    return;
+  }
+
+  queueEvent(onFrame, beat, NOTE_ON_COMMAND, channel, note.pitch, note.velocity);
+  queueEvent(offFrame, beat, NOTE_OFF_COMMAND, channel, note.pitch, 0);
+}
+
+/**
+ * Function: notifyNote
+ * --------------------
+ * Tells the graphics handler about a
+ * note half a beat before its beat.
+ */
+void Sequencer::notifyNote(int channel, const Note& note, int ticksFromBeat) {
+  // notify graphics handler of notes in layer on demand like audio
+  int distFromRealNow = ticksToMillis(ticksFromBeat) + 30000 / beatsPerMinute;
+  int duration = ticksToMillis(note.tickDuration);
+  if (handler == NULL) return; // offline
+
+  if (!blockMode) {
+    handler(callData, channel, note.position, note.velocity, distFromRealNow, duration);
+    return;
+  }
+
+  // the handler locks graphics state so it never runs on the render thread
+  unsigned long long noticeFrame = getHalfBeatFrame(2 * globalBeatCount);
+  NoteNotice notice = {noticeFrame, channel, note.position,
+    note.velocity, distFromRealNow, duration};
+  notices.push(notice);
+}
+
+/**
+ * Function: ticksToMillis
+ * -----------------------
+ * Converts ticks at the
+ * current tempo.
+ */
+int Sequencer::ticksToMillis(int ticks) {
+  return (long long) ticks * 60000 / ((long long) TICKS_PER_BEAT * beatsPerMinute);
+}
+
+/**
+ * Function: retractChannel
+ * ------------------------
+ * Takes back a channel's queued notes
+ * past the current beat. FluidSynth can
+ * only remove every event from a source,
+ * so what still belongs to the present
+ * goes out again: both edges of the
+ * unplayed notes of the current beat
+ * and the note offs of sounding ones.
+ */
+void Sequencer::retractChannel(int channel) {
+  if (blockMode) { // pending belongs to the render thread
+    dirtyChannels.push_back(channel);
+    return;
+  }
+
+  // nothing went out past this beat
+  if (audioBeatCount <= globalBeatCount) return;
+
+  seqLock.lock();
+  fluid_sequencer_remove_events(sequencer, channelSeqIDs[channel], -1, -1);
+  seqLock.unlock();
+
+  const vector<int>& slots = layers.getChannel(channel);
+  unsigned int tick = fluid_sequencer_get_tick(sequencer);
+
+  for (int i = 0; i < (int) slots.size(); i += 1) {
+    Layer* layer = layers.get(slots[i]);
+    if (layer -> muted || layer -> beatCount <= 0) continue;
+    if (layer -> beatStart == -1 || globalBeatCount < layer -> beatStart) continue;
+
+    // notes can ring past the end of their pass
+    int pass = (globalBeatCount - layer -> beatStart) / layer -> beatCount;
+    int first = layer -> beatIndex[0];
+    int last = layer -> beatIndex[layer -> beatCount];
+
+    for (int k = max(pass - 1, 0); k <= pass; k += 1) {
+      int loopBeat = layer -> beatStart + k * layer -> beatCount;
+      long long loopStart = (2LL * loopBeat + 1) * TICKS_PER_BEAT;
+
+      for (int j = first; j < last; j += 1) {
+        const Note& note = layer -> notes[j];
+        // later beats are queued again by scheduleAhead
+        if (loopBeat + note.tickOffset / TICKS_PER_BEAT > globalBeatCount) break;
+
+        long long start = loopStart + 2LL * note.tickOffset;
+        unsigned long long onFrame = transport.getFrameAt(start, 2 * TICKS_PER_BEAT);
+        unsigned long long offFrame = transport.getFrameAt(start + 2LL * note.tickDuration, 2 * TICKS_PER_BEAT);
+        if (offFrame <= tick) continue; // already over
+
+        if (onFrame > tick) sendNoteOn(channel, note.pitch, note.velocity, onFrame);
+        sendNoteOff(channel, note.pitch, offFrame);
+      }
+    }
+  }
+
+  flushEvents();
+}
+
+/**
+ * Function: scheduleAhead
+ * -----------------------
+ * Queues a channel's layers for every
+ * beat the lookahead already covers.
+ */
+void Sequencer::scheduleAhead(int channel) {
+  const vector<int>& slots = layers.getChannel(channel);
+  if (slots.empty()) return;
+
+  for (int i = 0; i < (int) slots.size(); i += 1)
+    for (int beat = globalBeatCount + 1; beat <= audioBeatCount; beat += 1)
+      scheduleBeat(layers.get(slots[i]), beat, true, false);
+  if (!blockMode) flushEvents();
+}
+
+/**
+ * Function: retractPending
+ * ------------------------
+ * Block mode retraction for channels
+ * the UI changed. Runs on the render
+ * thread under layerLock.
+ */
+void Sequencer::retractPending() {
+  for (int i = 0; i < dirtyChannels.size(); i += 1) {
+    int channel = dirtyChannels[i];
+
+    for (int j = 0; j < (int) pending.size(); ) {
+      PendingEvent& event = pending[j];
+      if (event.channel != channel || event.beat <= globalBeatCount) {
+        j += 1; // keep it
+        continue;
+      }
+
+      // order does not matter here
+      pending[j] = pending.back();
+      pending.pop_back();
+    }
+
+    scheduleAhead(channel);
+  }
+
+  dirtyChannels.clear();
+}
+
+/**
+ * Function: retractAhead
+ * ----------------------
+ * Takes back every channel's audio past
+ * the current beat so it can be queued
+ * again [at a new tempo].
+ */
+void Sequencer::retractAhead() {
+  if (audioBeatCount <= globalBeatCount) return;
+
+  if (!blockMode) { // through the sources
+    for (int i = 0; i < LAYER_CHANNELS; i += 1)
+      if (!layers.getChannel(i).empty()) retractChannel(i);
+  }
+
+  else { // already on the render thread
+    for (int i = 0; i < (int) pending.size(); ) {
+      if (pending[i].beat <= globalBeatCount) {
+        i += 1; // keep it
+        continue;
+      }
+
+      // order does not matter here
+      pending[i] = pending.back();
+      pending.pop_back();
+    }
+  }
+
+  audioBeatCount = globalBeatCount;
 }
 
 /**
@@ -160,53 +442,140 @@ void Sequencer::scheduleLayers() {
  */
 void Sequencer::scheduleTimer() {
   // set timer at the stagger point
-  now = now + msPerBeat / 2; // half
-  seqLock.lock();
+  now = getHalfBeatFrame(2 * globalBeatCount + 2);
 
-  // create timer event and schedule it
-  fluid_event_t* event = new_fluid_event();
+  // batch timer event with the notes
+  fluid_event_t* event = nextEvent(now);
   fluid_event_set_source(event, -1);
   fluid_event_set_dest(event, mySeqID);
   fluid_event_timer(event, NULL);
   // cout << "Timer to occur at " << now << "." << endl;
-  fluid_sequencer_send_at(sequencer, event, now, 1);
-
-  // clean up event
-  delete_fluid_event(event);
-  seqLock.unlock();
 }
 
 /**
  * Function: writeLayer
  * --------------------
  * Adds a sequence to be played on a given
- * channel. The sequence starts at the next
- * beat tick and will be played periodically.
+ * channel in place of whatever was there.
+ * The sequence starts at the next beat
+ * tick and will be played periodically.
  */
 void Sequencer::writeLayer(int channel, Layer layer) {
+  if (channel < 0 || channel >= LAYER_CHANNELS || channel == DRUM_CHANNEL) return;
+  layer.channel = channel; // one and the same
+
   // right now the entire layer is copied. in the
   // future, we might want to allocate memory for
   // layers and pass by reference here
-  channels[channel] = layer;
+  indexLayer(layer); // before anyone sees it
+  layerLock.lock();
+
+  // start at the next beat even if
+  // the lookahead has passed it
+  if (layer.beatStart == -1 && !layer.muted && fluid != NULL)
+    layer.beatStart = globalBeatCount + 1;
+
+  retractChannel(channel);
+  vector<int> replaced = layers.getChannel(channel);
+  for (int i = 0; i < (int) replaced.size(); i += 1)
+    layers.remove(replaced[i]);
+
+  layers.add(layer);
+  if (!blockMode) scheduleAhead(channel);
+  layerLock.unlock();
+}
+
+/**
+ * Function: addLayer
+ * ------------------
+ * Adds a sequence next to any others on its
+ * channel, starting at the next beat tick.
+ * Channels are retracted as a whole so the
+ * others are queued again with it.
+ */
+int Sequencer::addLayer(Layer layer) {
+  int channel = layer.channel;
+  if (channel < 0 || channel >= LAYER_CHANNELS || channel == DRUM_CHANNEL) return -1;
+
+  indexLayer(layer); // before anyone sees it
+  layerLock.lock();
+
+  // start at the next beat even if
+  // the lookahead has passed it
+  if (layer.beatStart == -1 && !layer.muted && fluid != NULL)
+    layer.beatStart = globalBeatCount + 1;
+
+  retractChannel(channel);
+  int slot = layers.add(layer);
+  if (!blockMode) scheduleAhead(channel);
+  layerLock.unlock();
+  return slot;
+}
+
+/**
+ * Function: indexLayer
+ * --------------------
+ * Sorts layer notes by offset and records
+ * where each beat starts, so that a beat
+ * tick only touches the notes it plays.
+ */
+void Sequencer::indexLayer(Layer& layer) {
+  layer.beatIndex.clear();
+  if (layer.beatCount <= 0) return; // junk
+
+  // stable so simultaneous notes keep their order
+  stable_sort(layer.notes.begin(), layer.notes.end(), noteBefore);
+
+  // beatIndex[beat] is the first note at or after the
+  // beat and beatIndex[beatCount] ends the last beat
+  int noteIndex = 0;
+  for (int beat = 0; beat <= layer.beatCount; beat += 1) {
+    int beatOffset = beat * TICKS_PER_BEAT;
+    while (noteIndex < layer.notes.size() && layer.notes[noteIndex].tickOffset < beatOffset)
+      noteIndex += 1; // notes before the layer starts are never played
+    layer.beatIndex.push_back(noteIndex);
+  }
 }
 
 /**
  * Function: toggleLayerIfExists
  * -----------------------------
- * Toggle the muting on a given layer
- * if it already exists in the map.
+ * Toggle the muting on every layer
+ * of a channel if it has any.
  */
 void Sequencer::toggleLayerIfExists(int channel) {
-  if (channels.count(channel) == 0) return;
-  bool oldState = channels[channel].muted;
-  channels[channel].muted = !oldState;
+  layerLock.lock(); // hold layers steady
+  vector<int> slots = layers.getChannel(channel);
+  if (slots.empty()) {
+    layerLock.unlock();
+    return;
+  }
 
-  // now muting so reset the channel reference point
-  if (!oldState) channels[channel].beatStart = -1;
-  else channels[channel].beatStart = globalBeatCount;
+  retractChannel(channel);
+  for (int i = 0; i < (int) slots.size(); i += 1)
+    toggleSlot(slots[i]);
+  if (!blockMode) scheduleAhead(channel);
+  layerLock.unlock();
   fluid -> allNotesOff(channel);
 }
 
+/**
+ * Function: toggleSlot
+ * --------------------
+ * Flips muting on a slot and moves
+ * it in or out of the active list.
+ */
+void Sequencer::toggleSlot(int slot) {
+  Layer* layer = layers.get(slot);
+  bool oldState = layer -> muted;
+  layer -> muted = !oldState;
+
+  // now muting so reset the channel reference point
+  if (!oldState) layer -> beatStart = -1;
+  else layer -> beatStart = globalBeatCount;
+  layers.refresh(slot);
+}
+
 /**
  * Function: getGlobalBeatCount
  * ----------------------------
@@ -218,6 +587,79 @@ int Sequencer::getGlobalBeatCount() {
   return globalBeatCount;
 }
 
+/**
+ * Function: setDriftHistogram
+ * ---------------------------
+ * Starts recording how late each
+ * beat gets scheduled.
+ */
+void Sequencer::setDriftHistogram(Histogram* histogram) {
+  // just a mutator because style
+  driftHistogram = histogram;
+}
+
+/**
+ * Function: getLayers
+ * -------------------
+ * Copies out every written layer
+ * [used for bouncing and saving].
+ */
+vector<Layer> Sequencer::getLayers() {
+  vector<Layer> written;
+  layerLock.lock(); // hold layers steady
+
+  for (int i = 0; i < layers.getSlotCount(); i += 1)
+    if (layers.get(i) != NULL) written.push_back(*layers.get(i));
+
+  layerLock.unlock();
+  return written;
+}
+
+/**
+ * Function: getLayerCount
+ * -----------------------
+ * Get the layers written.
+ */
+int Sequencer::getLayerCount() {
+  // just an accessor because style
+  return layers.getLayerCount();
+}
+
+/**
+ * Function: getBeatsPerMinute
+ * ---------------------------
+ * Get the sequencer tempo.
+ */
+int Sequencer::getBeatsPerMinute() {
+  // just an accessor because style
+  return beatsPerMinute;
+}
+
+/**
+ * Function: setTempo
+ * ------------------
+ * Queues a tempo change for the
+ * scheduler to make at a beat.
+ */
+void Sequencer::setTempo(int bpm) {
+  if (bpm <= 0) return; // sanity
+  layerLock.lock(); // read while scheduling
+  nextTempo = bpm;
+  layerLock.unlock();
+}
+
+/**
+ * Function: setLookahead
+ * ----------------------
+ * Sets how many beats past the current
+ * one have their audio queued early.
+ */
+void Sequencer::setLookahead(int beats) {
+  layerLock.lock(); // read while scheduling
+  lookaheadBeats = beats < 0 ? 0 : beats;
+  layerLock.unlock();
+}
+
 /**
  * Static Function: callback
  * -------------------------
@@ -227,47 +669,208 @@ void Sequencer::callback(unsigned int time, fluid_event_t* event, fluid_sequence
   // this will advance the schedule-note-schedule-timer cycle
   Sequencer* current = (Sequencer*) data; // data was passed as this
   // cout << "Called back at " << current -> now << "." << endl;
+
+  // how far behind the intended tick we are
+  if (current -> driftHistogram) {
+    unsigned int tick = fluid_sequencer_get_tick(seq);
+    unsigned int late = tick > current -> now ? tick - current -> now : 0;
+    current -> driftHistogram -> record(1000 * late);
+  }
+
+  current -> layerLock.lock();
   current -> scheduleLayers();
+  current -> layerLock.unlock();
+}
+
+/**
+ * Static Function: synthCallback
+ * ------------------------------
+ * Hands sequenced notes to the
+ * synthesizer in timer mode.
+ */
+void Sequencer::synthCallback(unsigned int time, fluid_event_t* event, fluid_sequencer_t* seq, void* data) {
+  Sequencer* current = (Sequencer*) data; // data was passed as this
+  int channel = fluid_event_get_channel(event);
+  short key = fluid_event_get_key(event);
+
+  switch (fluid_event_get_type(event)) {
+    case FLUID_SEQ_NOTEON:
+      current -> fluid -> noteOn(channel, key, fluid_event_get_velocity(event));
+      break;
+    case FLUID_SEQ_NOTEOFF:
+      current -> fluid -> noteOff(channel, key);
+      break;
+  }
+}
+
+/**
+ * Static Function: blockCallback
+ * ------------------------------
+ * Calls at the start of every
+ * render block in block mode.
+ */
+void Sequencer::blockCallback(void* data, unsigned long long frame, unsigned int numFrames) {
+  // this replaces the timer cycle when scheduling in blocks
+  Sequencer* current = (Sequencer*) data; // data was passed as this
+  current -> renderBlock(frame, numFrames);
+}
+
+/**
+ * Function: renderBlock
+ * ---------------------
+ * Schedules any beat whose half beat lead in
+ * starts before the end of this block, then
+ * hands every due note edge to the synth at
+ * its sample offset. Runs on the render
+ * thread so it never waits on a lock.
+ */
+void Sequencer::renderBlock(unsigned long long frame, unsigned int numFrames) {
+  unsigned long long blockEnd = frame + numFrames;
+
+  // if the UI is writing layers just try again next block
+  if (layerLock.tryLock()) {
+    retractPending(); // changed channels
+
+    unsigned long long due; // when the timer would have fired
+    while ((due = getHalfBeatFrame(2 * (globalBeatCount + 1))) < blockEnd) {
+      scheduleLayers(); // same as a timer tick
+
+      // drift is how far from the block start it was due, either
+      // way, since the whole block is scheduled at that instant
+      if (driftHistogram) {
+        unsigned long long drift = frame > due ? frame - due : due - frame;
+        driftHistogram -> record(drift * 1000000 / fluid -> getSampleRate());
+      }
+    }
+
+    layerLock.unlock();
+  }
+
+  for (int i = 0; i < (int) pending.size(); ) {
+    PendingEvent& event = pending[i];
+    if (event.frame >= blockEnd) {
+      i += 1; // not due yet
+      continue;
+    }
+
+    // anything that is late plays at the start of the block
+    unsigned int offset = event.frame > frame ? event.frame - frame : 0;
+    if (!fluid -> scheduleCommand(offset, event.type,
+      event.channel, event.key, event.velocity))
+      break; // block is full so the rest wait
+
+    // order does not matter here
+    pending[i] = pending.back();
+    pending.pop_back();
+  }
+}
+
+/**
+ * Function: getHalfBeatFrame
+ * --------------------------
+ * Get the frame of a half beat counted
+ * from sequencer start. Exact integer
+ * math so that long loops never drift.
+ */
+unsigned long long Sequencer::getHalfBeatFrame(int halfBeats) {
+  // exact from the origin [in ms ticks in timer mode]
+  return transport.getFrameAt(halfBeats, 2);
+}
+
+/**
+ * Function: queueEvent
+ * --------------------
+ * Holds a note edge until the
+ * block it falls in is rendered.
+ */
+void Sequencer::queueEvent(unsigned long long frame, int beat, int type, int channel, int key, int velocity) {
+  // full means we would have to allocate
+  if (pending.size() == PENDING_CAPACITY)
+    return;
+
+  PendingEvent event = {frame, beat, type, channel, key, velocity};
+  pending.push_back(event);
+}
+
+/**
+ * Function: dispatchNotes
+ * -----------------------
+ * Passes graphics notes queued by the render
+ * thread to the note handler, correcting for
+ * how long each one has been waiting.
+ */
+void Sequencer::dispatchNotes() {
+  if (!blockMode) return;
+
+  long long rate = fluid -> getSampleRate();
+  long long current = fluid -> getFrameCount();
+  NoteNotice notice;
+
+  while (notices.pop(notice)) {
+    int waited = (current - (long long) notice.frame) * 1000 / rate;
+    handler(callData, notice.channel, notice.position, notice.velocity,
+      notice.distance - waited, notice.duration);
+  }
 }
 
 /**
  * Function: sendNoteOn
  * --------------------
- * Schedules a note on a channel.
+ * Batches a note on a channel
+ * until the next flushEvents.
  */
 void Sequencer::sendNoteOn(int channel, short key, short velocity, unsigned int date) {
-  int fluidSched;
-  seqLock.lock();
-
-  // create note event and schedule it
-  fluid_event_t* event = new_fluid_event();
-  fluid_event_set_source(event, -1);
+  // fill in a pooled note event
+  fluid_event_t* event = nextEvent(date);
+  fluid_event_set_source(event, channelSeqIDs[channel]);
   fluid_event_set_dest(event, synthSeqID);
   fluid_event_noteon(event, channel, key, velocity);
-  fluidSched = fluid_sequencer_send_at(sequencer, event, date, 1);
-
-  // clean up event
-  seqLock.unlock();
-  delete_fluid_event(event);
 }
 
 /**
  * Function: sendNoteOff
  * ---------------------
- * Schedules a note off on a channel.
+ * Batches a note off on a channel
+ * until the next flushEvents.
  */
 void Sequencer::sendNoteOff(int channel, short key, unsigned int date) {
-  int fluidSched;
-  seqLock.lock();
-
-  // create note event and schedule it
-  fluid_event_t* event = new_fluid_event();
-  fluid_event_set_source(event, -1);
+  // same source as note ons so both are retracted
+  fluid_event_t* event = nextEvent(date);
+  fluid_event_set_source(event, channelSeqIDs[channel]);
   fluid_event_set_dest(event, synthSeqID);
   fluid_event_noteoff(event, channel, key);
-  fluidSched = fluid_sequencer_send_at(sequencer, event, date, 1);
+}
 
-  // clean up event
+/**
+ * Function: nextEvent
+ * -------------------
+ * Hands out the next unused pooled event
+ * for this batch. The pool only grows when
+ * a pass is bigger than any before it.
+ */
+fluid_event_t* Sequencer::nextEvent(unsigned int date) {
+  if (batchSize == eventPool.size()) {
+    eventPool.push_back(new_fluid_event());
+    batchDates.push_back(0);
+  }
+
+  batchDates[batchSize] = date;
+  return eventPool[batchSize++];
+}
+
+/**
+ * Function: flushEvents
+ * ---------------------
+ * Sends every batched event to FluidSynth
+ * under a single lock. The sequencer copies
+ * events on send so the pool is reusable.
+ */
+void Sequencer::flushEvents() {
+  seqLock.lock();
+  for (int i = 0; i < batchSize; i += 1)
+    fluid_sequencer_send_at(sequencer, eventPool[i], batchDates[i], 1);
   seqLock.unlock();
-  delete_fluid_event(event);
+
+  // start the next pass
+  batchSize = 0;
 }
@@ -10,64 +10,181 @@
 #define SEQUENCER_H
 
 #include <fluidsynth.h>
-#include <map> // layers
 
 #include "synthesizer.h"
+#include "transport.h"
+#include "ringbuffer.h"
+#include "histogram.h"
+#include "layertable.h"
 #include "layer.h"
 #include "ofMain.h"
 
-// our access to C++11 is not guaranteed
-typedef map<int, Layer>::iterator itType;
-
 // used as a graphics callback function type
-typedef vector<Block*> (*NoteHandler)(void*, int, int, int, int, int);
+typedef NoteBlocks (*NoteHandler)(void*, int, int, int, int, int);
+
+// a note edge waiting for
+// its block in block mode
+struct PendingEvent {
+  unsigned long long frame;
+  int beat; // scheduled for
+  int type; // SynthCommandType
+  int channel;
+  int key;
+  int velocity;
+};
+
+// a graphics notification made on the
+// render thread and handed to the handler
+// later from dispatchNotes [block mode]
+struct NoteNotice {
+  unsigned long long frame;
+  int channel;
+  int position;
+  int velocity;
+  int distance;
+  int duration;
+};
 
 // sequences MIDI
 class Sequencer {
+  // times scheduleLayers directly
+  friend class Benchmark;
+
   public:
     Sequencer();
     ~Sequencer();
 
-    // initialize sequencer to a preset tempo, synthesizer, and note handler
-    bool init(Synthesizer* synth, int beatsPerMinute, NoteHandler call, void* data);
+    // initialize sequencer to a preset tempo, synthesizer, and note handler. in
+    // block mode notes are scheduled with sample offsets from inside the synth
+    // render loop instead of from a FluidSynth timer
+    bool init(Synthesizer* synth, int beatsPerMinute,
+      NoteHandler call, void* data, bool inBlocks = false);
 
-    // add a sequence to be played on a given 
-    // channel. it will start at next beat tick
+    // add a sequence to be played on a given channel in
+    // place of any layers on it. it will start at next beat tick
     void writeLayer(int channel, Layer layer);
+    // add a sequence alongside any others on its channel and get
+    // its slot [-1 unless the channel is 0 to 15 but not drums]
+    int addLayer(Layer layer);
 
-    // toggles muting on a given channel layer
+    // toggles muting on every layer of a given channel
     void toggleLayerIfExists(int channel);
 
     // get the global beat count
     int getGlobalBeatCount();
 
+    // copy out every written layer [in slot order]
+    vector<Layer> getLayers();
+    int getLayerCount();
+    int getBeatsPerMinute();
+
+    // change tempo from the next beat on [notes are
+    // in ticks so layers are never touched again]
+    void setTempo(int beatsPerMinute);
+
+    // hand queued block mode notes to the
+    // note handler [call from the UI thread]
+    void dispatchNotes();
+
+    // record how far each beat is scheduled from when it was due
+    // [late timer callbacks, or either side of the block start]
+    void setDriftHistogram(Histogram* histogram);
+
+    // audio for this many beats past the current one goes out early so
+    // late callbacks cost a head start instead of notes [graphics still
+    // come half a beat ahead and mutes or rewrites retract the rest]
+    void setLookahead(int beats);
+
   protected:
+    // sort notes and bucket them by beat
+    void indexLayer(Layer& layer);
+
     // run sequencer loop
     void scheduleLayers();
     void scheduleTimer();
 
-    // actually schedule a note at the given time specified by date
+    // audio and or graphics for one beat of a layer
+    void scheduleBeat(Layer* layer, int beat, bool audio, bool notify);
+    // schedule a note from the pass of its layer that started at loopBeat
+    void scheduleNote(int channel, const Note& note, int loopBeat);
+    // hand a note of the current beat to the graphics
+    void notifyNote(int channel, const Note& note, int ticksFromBeat);
+    int ticksToMillis(int ticks);
+
+    // drop a channel's notes past the current beat [before changing
+    // its layers] and queue its layers again [after] under layerLock
+    void retractChannel(int channel);
+    void scheduleAhead(int channel);
+    // mute or unmute one slot in place
+    void toggleSlot(int slot);
+    // block mode does both on the render thread
+    void retractPending();
+    // drop all audio past the current beat
+    void retractAhead();
+
+    // actually schedule a note at the given time specified by date [these
+    // only batch the event and flushEvents sends the whole pass at once]
     void sendNoteOn(int channel, short key, short velocity, unsigned int date);
     void sendNoteOff(int channel, short key, unsigned int date);
+    fluid_event_t* nextEvent(unsigned int date);
+    void flushEvents();
 
     // called when the timer scheduled by scheduleTimer goes off
     static void callback(unsigned int time, fluid_event_t* event, fluid_sequencer_t* seq, void* data);
+    // delivers sequenced notes to the synthesizer
+    static void synthCallback(unsigned int time, fluid_event_t* event, fluid_sequencer_t* seq, void* data);
+
+    // block mode equivalents of the timer cycle
+    static void blockCallback(void* data, unsigned long long frame, unsigned int numFrames);
+    void renderBlock(unsigned long long frame, unsigned int numFrames);
+    unsigned long long getHalfBeatFrame(int halfBeats);
+    void queueEvent(unsigned long long frame, int beat, int type, int channel, int key, int velocity);
 
     NoteHandler handler;
     void* callData;
 
-    map<int, Layer> channels;
+    // every layer in a flat table and the
+    // slots that sound [what beats walk]
+    LayerTable layers;
     short mySeqID, synthSeqID;
     unsigned int now;
 
+    // note sources per channel so
+    // both edges can be retracted
+    short channelSeqIDs[16];
+
     int globalBeatCount;
+    int audioBeatCount; // last beat with audio out
+    int lookaheadBeats;
     int beatsPerMeasure;
     int beatsPerMinute;
-    int msPerBeat;
+    int nextTempo; // 0 if unchanged
+
+    // places every beat exactly [frames
+    // in block mode and ms ticks if not]
+    Transport transport;
 
     fluid_sequencer_t* sequencer;
     Synthesizer* fluid;
     ofMutex seqLock;
+
+    // reused events for one scheduling pass
+    vector<fluid_event_t*> eventPool;
+    vector<unsigned int> batchDates;
+    int batchSize;
+
+    // guards layers between
+    // the UI and scheduling
+    ofMutex layerLock;
+
+    // beat callback drift
+    Histogram* driftHistogram;
+
+    // block mode state [render thread]
+    bool blockMode;
+    vector<PendingEvent> pending;
+    RingBuffer<NoteNotice> notices;
+    vector<int> dirtyChannels; // under layerLock
 };
 
 // guard
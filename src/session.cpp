@@ -0,0 +1,278 @@
+/**
+ * File: session.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Binary session files holding every
+ * layer plus tempo and meter, laid out
+ * so they can be mapped and read with
+ * no parsing at all.
+ */
+
+#include "session.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iostream>
+using namespace std;
+
+/**
+ * Constructor: Session
+ * --------------------
+ * Starts with nothing mapped.
+ */
+Session::Session() {
+  mapping = NULL;
+  mappingSize = 0;
+
+  header = NULL;
+  layers = NULL;
+  notes = NULL;
+}
+
+/**
+ * Destructor: ~Session
+ * --------------------
+ * Unmaps the session file.
+ */
+Session::~Session() {
+  unmap();
+}
+
+/**
+ * Function: load
+ * --------------
+ * Maps a session file read only and
+ * checks that every record lies inside
+ * it. Layers are copied out later.
+ */
+bool Session::load(const string path) {
+  unmap(); // drop any earlier file
+
+  int file = open(path.c_str(), O_RDONLY);
+  if (file == -1) {
+    cerr << "Cannot open session file: " << path << "." << endl;
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(file, &info) == -1 || info.st_size < (off_t) sizeof(SessionHeader)) {
+    cerr << "Session file is too short: " << path << "." << endl;
+    close(file);
+    return false;
+  }
+
+  // the mapping outlives the descriptor
+  mappingSize = info.st_size;
+  mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+
+  if (mapping == MAP_FAILED) {
+    cerr << "Cannot map session file: " << path << "." << endl;
+    mapping = NULL;
+    return false;
+  }
+
+  header = (const SessionHeader*) mapping;
+  if (header -> magic != SESSION_MAGIC || header -> version < 1 || header -> version > SESSION_VERSION) {
+    cerr << "Not a known session file: " << path << "." << endl;
+    unmap();
+    return false;
+  }
+
+  // timing divides by both of these
+  if (header -> beatsPerMinute < MIN_BEATS_PER_MINUTE || header -> beatsPerMinute > MAX_BEATS_PER_MINUTE
+    || header -> beatsPerMeasure < 1 || header -> beatsPerMeasure > MAX_BEATS_PER_MEASURE) {
+    cerr << "Session tempo or meter is out of range: " << path << "." << endl;
+    unmap();
+    return false;
+  }
+
+  // make sure the records fit in the file
+  unsigned long long needed = sizeof(SessionHeader);
+  needed += (unsigned long long) header -> layerCount * sizeof(SessionLayer);
+  needed += (unsigned long long) header -> noteCount * sizeof(SessionNote);
+  if (needed > mappingSize) {
+    cerr << "Session file is truncated: " << path << "." << endl;
+    unmap();
+    return false;
+  }
+
+  layers = (const SessionLayer*) (header + 1);
+  notes = (const SessionNote*) (layers + header -> layerCount);
+
+  // and each layer fits in the notes
+  for (uint32_t i = 0; i < header -> layerCount; i += 1) {
+    unsigned long long last = (unsigned long long) layers[i].firstNote + layers[i].noteCount;
+    if (last > header -> noteCount) {
+      cerr << "Session layer is out of bounds: " << path << "." << endl;
+      unmap();
+      return false;
+    }
+  }
+
+  // positions pick note colors and stripes
+  for (uint32_t i = 0; i < header -> noteCount; i += 1) {
+    if (notes[i].position < 0 || notes[i].position >= NOTE_POSITIONS) {
+      cerr << "Session note is out of range: " << path << "." << endl;
+      unmap();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Static Function: save
+ * ---------------------
+ * Writes layers in the same layout
+ * load maps. Layers are written in
+ * the order given.
+ */
+bool Session::save(const string path, const vector<Layer>& layers,
+  int beatsPerMinute, int beatsPerMeasure) {
+  ofstream out(path.c_str(), ios::binary);
+  if (!out) {
+    cerr << "Cannot write session file: " << path << "." << endl;
+    return false;
+  }
+
+  SessionHeader header;
+  header.magic = SESSION_MAGIC;
+  header.version = SESSION_VERSION;
+  header.beatsPerMinute = beatsPerMinute;
+  header.beatsPerMeasure = beatsPerMeasure;
+  header.layerCount = layers.size();
+  header.noteCount = 0;
+
+  for (int i = 0; i < layers.size(); i += 1)
+    header.noteCount += layers[i].notes.size();
+  out.write((const char*) &header, sizeof(header));
+
+  uint32_t firstNote = 0;
+  for (int i = 0; i < layers.size(); i += 1) {
+    SessionLayer record;
+    record.channel = layers[i].channel;
+    record.program = layers[i].program;
+    record.beatCount = layers[i].beatCount;
+    record.muted = layers[i].muted;
+    record.firstNote = firstNote;
+    record.noteCount = layers[i].notes.size();
+
+    out.write((const char*) &record, sizeof(record));
+    firstNote += record.noteCount;
+  }
+
+  for (int i = 0; i < layers.size(); i += 1) {
+    const vector<Note>& layerNotes = layers[i].notes;
+    for (int j = 0; j < layerNotes.size(); j += 1) {
+      SessionNote record;
+      record.pitch = layerNotes[j].pitch;
+      record.velocity = layerNotes[j].velocity;
+      record.offset = layerNotes[j].tickOffset;
+      record.duration = layerNotes[j].tickDuration;
+      record.position = layerNotes[j].position;
+      out.write((const char*) &record, sizeof(record));
+    }
+  }
+
+  return (bool) out;
+}
+
+/**
+ * Function: getBeatsPerMinute
+ * ---------------------------
+ * Get the saved tempo.
+ */
+int Session::getBeatsPerMinute() {
+  if (header == NULL) return 0;
+  return header -> beatsPerMinute;
+}
+
+/**
+ * Function: getBeatsPerMeasure
+ * ----------------------------
+ * Get the saved meter.
+ */
+int Session::getBeatsPerMeasure() {
+  if (header == NULL) return 0;
+  return header -> beatsPerMeasure;
+}
+
+/**
+ * Function: getLayerCount
+ * -----------------------
+ * Get the number of saved layers.
+ */
+int Session::getLayerCount() {
+  if (header == NULL) return 0;
+  return header -> layerCount;
+}
+
+/**
+ * Function: getLayer
+ * ------------------
+ * Copies one layer out of the mapping.
+ * It starts unplayed [beatStart is -1].
+ */
+Layer Session::getLayer(int index) {
+  Layer layer; // empty if out of range
+  if (index < 0 || index >= getLayerCount()) return layer;
+
+  const SessionLayer& record = layers[index];
+  layer.channel = record.channel;
+  layer.program = record.program;
+  layer.beatCount = record.beatCount;
+  layer.muted = record.muted != 0;
+
+  const SessionNote* first = notes + record.firstNote;
+  layer.notes.resize(record.noteCount);
+
+  // ms to ticks for version 1
+  long long scale = TICKS_PER_BEAT;
+  long long divisor = 1;
+  if (header -> version == 1) {
+    scale = (long long) header -> beatsPerMinute * TICKS_PER_BEAT;
+    divisor = 60000;
+  }
+
+  for (uint32_t i = 0; i < record.noteCount; i += 1) {
+    Note& note = layer.notes[i];
+    note.pitch = first[i].pitch;
+    note.velocity = first[i].velocity;
+    note.tickOffset = first[i].offset * scale / divisor;
+    note.tickDuration = first[i].duration * scale / divisor;
+    note.position = first[i].position;
+  }
+
+  return layer;
+}
+
+/**
+ * Function: getLayers
+ * -------------------
+ * Copies every layer out.
+ */
+vector<Layer> Session::getLayers() {
+  vector<Layer> result;
+  for (int i = 0; i < getLayerCount(); i += 1)
+    result.push_back(getLayer(i));
+  return result;
+}
+
+/**
+ * Function: unmap
+ * ---------------
+ * Releases the mapping if any.
+ */
+void Session::unmap() {
+  if (mapping) munmap(mapping, mappingSize);
+  mapping = NULL;
+  mappingSize = 0;
+
+  header = NULL;
+  layers = NULL;
+  notes = NULL;
+}
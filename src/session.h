@@ -0,0 +1,99 @@
+/**
+ * File: session.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Binary session files holding every
+ * layer plus tempo and meter, laid out
+ * so they can be mapped and read with
+ * no parsing at all.
+ */
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "layer.h"
+using namespace std;
+
+// "PSTS" read as little endian
+const uint32_t SESSION_MAGIC = 0x53545350;
+// version 1 stored notes in ms and
+// loads by converting at its tempo
+const uint32_t SESSION_VERSION = 2;
+
+// what the tempo and meter keys allow
+// [files outside them are rejected]
+const int MIN_BEATS_PER_MINUTE = 24;
+const int MAX_BEATS_PER_MINUTE = 200;
+const int MAX_BEATS_PER_MEASURE = 24;
+// a note comes from one of the keys a to z
+const int NOTE_POSITIONS = 26;
+
+// file layout is a header, then every layer
+// record, then every note packed together
+struct SessionHeader {
+  uint32_t magic;
+  uint32_t version;
+  int32_t beatsPerMinute;
+  int32_t beatsPerMeasure;
+  uint32_t layerCount;
+  uint32_t noteCount; // over all layers
+};
+
+// one layer and its run of notes
+struct SessionLayer {
+  int32_t channel;
+  int32_t program;
+  int32_t beatCount;
+  int32_t muted;
+  uint32_t firstNote; // index into notes
+  uint32_t noteCount;
+};
+
+// mirrors Note with fixed sizes
+struct SessionNote {
+  float pitch;
+  int32_t velocity;
+  int32_t offset; // ticks [ms in version 1]
+  int32_t duration;
+  int32_t position;
+};
+
+// a mapped session file
+class Session {
+  public:
+    Session();
+    ~Session();
+
+    // map a session and check it [false on a bad file]
+    bool load(const string path);
+    // write layers and their tempo and meter to a file
+    static bool save(const string path, const vector<Layer>& layers,
+      int beatsPerMinute, int beatsPerMeasure);
+
+    // accessors into the mapping
+    int getBeatsPerMinute();
+    int getBeatsPerMeasure();
+    int getLayerCount();
+
+    // copy layers out of the mapping
+    Layer getLayer(int index);
+    vector<Layer> getLayers();
+
+  protected:
+    // release any mapping
+    void unmap();
+
+    void* mapping;
+    size_t mappingSize;
+
+    // views into the mapping
+    const SessionHeader* header;
+    const SessionLayer* layers;
+    const SessionNote* notes;
+};
+
+// guard
+#endif
@@ -0,0 +1,532 @@
+/**
+ * File: sfsubset.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Writes a smaller soundfont holding
+ * only the presets we play, so load
+ * time and memory follow what is used.
+ */
+
+#include "sfsubset.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+using namespace std;
+
+// hydra record sizes [bytes]
+const int PHDR_SIZE = 38;
+const int INST_SIZE = 22;
+const int BAG_SIZE = 4;
+const int MOD_SIZE = 10;
+const int GEN_SIZE = 4;
+const int SHDR_SIZE = 46;
+
+// where each header keeps its first bag
+const int PHDR_BAG = 24;
+const int INST_BAG = 20;
+
+// generators that point down a level
+const unsigned int GEN_INSTRUMENT = 41;
+const unsigned int GEN_SAMPLE_ID = 53;
+
+// sample types we care about
+const unsigned int MONO_SAMPLE = 1;
+const unsigned int ROM_SAMPLE = 0x8000;
+// zero points the spec wants after each sample
+const unsigned int SAMPLE_PAD = 46;
+
+// raw records of one hydra chunk
+struct Records {
+  vector<char> data;
+  int size; // bytes per record
+  int count; // including the terminal one
+};
+
+/**
+ * Function: readLE
+ * ----------------
+ * Reads a little endian integer.
+ */
+unsigned int readLE(const char* bytes, int count) {
+  unsigned int value = 0;
+  for (int i = count - 1; i >= 0; i -= 1)
+    value = (value << 8) | (unsigned char) bytes[i];
+  return value;
+}
+
+/**
+ * Function: writeLE
+ * -----------------
+ * Writes a little endian integer.
+ */
+void writeLE(char* bytes, unsigned int value, int count) {
+  for (int i = 0; i < count; i += 1) {
+    bytes[i] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+/**
+ * Function: field
+ * ---------------
+ * Reads a field of one record.
+ */
+unsigned int field(const Records& records, int index, int offset, int count) {
+  return readLE(&records.data[index * records.size + offset], count);
+}
+
+/**
+ * Function: patch
+ * ---------------
+ * Overwrites a field of one record.
+ */
+void patch(Records& records, int index, int offset, unsigned int value, int count) {
+  writeLE(&records.data[index * records.size + offset], value, count);
+}
+
+/**
+ * Function: append
+ * ----------------
+ * Copies one record onto the end
+ * of another set of records and
+ * returns where it landed.
+ */
+int append(Records& out, const Records& in, int index) {
+  vector<char>::const_iterator first = in.data.begin() + index * in.size;
+  out.data.insert(out.data.end(), first, first + in.size);
+  return out.count++;
+}
+
+/**
+ * Function: appendChunk
+ * ---------------------
+ * Writes a RIFF chunk, padded
+ * to an even length.
+ */
+void appendChunk(vector<char>& out, const char* id, const vector<char>& data) {
+  char header[8];
+  memcpy(header, id, 4);
+  writeLE(header + 4, data.size(), 4);
+
+  out.insert(out.end(), header, header + 8);
+  out.insert(out.end(), data.begin(), data.end());
+  if (data.size() % 2) out.push_back(0);
+}
+
+/**
+ * Function: appendList
+ * --------------------
+ * Writes a RIFF list of chunks.
+ */
+void appendList(vector<char>& out, const char* type, const vector<char>& body) {
+  char header[12];
+  memcpy(header, "LIST", 4);
+  writeLE(header + 4, body.size() + 4, 4);
+  memcpy(header + 8, type, 4);
+
+  out.insert(out.end(), header, header + 12);
+  out.insert(out.end(), body.begin(), body.end());
+}
+
+/**
+ * Function: checkLevel
+ * --------------------
+ * Whether every header, bag, modulator,
+ * and generator index of a level stays
+ * in order and inside its chunk.
+ */
+bool checkLevel(const Records& headers, int bagField,
+  const Records& bags, const Records& mods, const Records& gens) {
+  if (headers.count < 1 || bags.count < 1) return false;
+  if (mods.count < 1 || gens.count < 1) return false;
+
+  for (int i = 0; i + 1 < headers.count; i += 1) {
+    unsigned int first = field(headers, i, bagField, 2);
+    unsigned int last = field(headers, i + 1, bagField, 2);
+    if (first > last || last >= (unsigned int) bags.count) return false;
+  }
+
+  for (int i = 0; i + 1 < bags.count; i += 1) {
+    unsigned int firstGen = field(bags, i, 0, 2);
+    unsigned int lastGen = field(bags, i + 1, 0, 2);
+    if (firstGen > lastGen || lastGen >= (unsigned int) gens.count) return false;
+
+    unsigned int firstMod = field(bags, i, 2, 2);
+    unsigned int lastMod = field(bags, i + 1, 2, 2);
+    if (firstMod > lastMod || lastMod >= (unsigned int) mods.count) return false;
+  }
+
+  return true;
+}
+
+/**
+ * Function: collectLinks
+ * ----------------------
+ * Gathers every target one generator
+ * points at from some headers [the
+ * instruments of some presets, or the
+ * samples of some instruments].
+ */
+void collectLinks(const Records& headers, int bagField, const Records& bags,
+  const Records& gens, const vector<int>& kept, unsigned int linkOper, set<int>& links) {
+  for (size_t i = 0; i < kept.size(); i += 1) {
+    unsigned int lastBag = field(headers, kept[i] + 1, bagField, 2);
+    for (unsigned int bag = field(headers, kept[i], bagField, 2); bag < lastBag; bag += 1) {
+
+      unsigned int lastGen = field(bags, bag + 1, 0, 2);
+      for (unsigned int gen = field(bags, bag, 0, 2); gen < lastGen; gen += 1)
+        if (field(gens, gen, 0, 2) == linkOper) links.insert(field(gens, gen, 2, 2));
+    }
+  }
+}
+
+/**
+ * Function: copyLevel
+ * -------------------
+ * Copies some headers of a level with their
+ * bags, modulators, and generators, then the
+ * terminal records. Indices are renumbered
+ * as they land and the link generator is
+ * pointed at its target's new index.
+ */
+void copyLevel(const Records& headers, int bagField, const Records& bags,
+  const Records& mods, const Records& gens, const vector<int>& kept,
+  unsigned int linkOper, const vector<int>& remap, Records& outHeaders,
+  Records& outBags, Records& outMods, Records& outGens) {
+  for (size_t i = 0; i < kept.size(); i += 1) {
+    int header = append(outHeaders, headers, kept[i]);
+    patch(outHeaders, header, bagField, outBags.count, 2);
+
+    unsigned int lastBag = field(headers, kept[i] + 1, bagField, 2);
+    for (unsigned int bag = field(headers, kept[i], bagField, 2); bag < lastBag; bag += 1) {
+      int newBag = append(outBags, bags, bag);
+      patch(outBags, newBag, 0, outGens.count, 2);
+      patch(outBags, newBag, 2, outMods.count, 2);
+
+      unsigned int lastMod = field(bags, bag + 1, 2, 2);
+      for (unsigned int mod = field(bags, bag, 2, 2); mod < lastMod; mod += 1)
+        append(outMods, mods, mod);
+
+      unsigned int lastGen = field(bags, bag + 1, 0, 2);
+      for (unsigned int gen = field(bags, bag, 0, 2); gen < lastGen; gen += 1) {
+        int newGen = append(outGens, gens, gen);
+        if (field(gens, gen, 0, 2) != linkOper) continue;
+        patch(outGens, newGen, 2, remap[field(gens, gen, 2, 2)], 2);
+      }
+    }
+  }
+
+  // terminal records point one past the end
+  int header = append(outHeaders, headers, headers.count - 1);
+  patch(outHeaders, header, bagField, outBags.count, 2);
+  int bag = append(outBags, bags, bags.count - 1);
+  patch(outBags, bag, 0, outGens.count, 2);
+  patch(outBags, bag, 2, outMods.count, 2);
+  append(outMods, mods, mods.count - 1);
+  append(outGens, gens, gens.count - 1);
+}
+
+/**
+ * Function: extract
+ * -----------------
+ * Parses the source's RIFF lists, keeps the
+ * bank 0 presets for the programs and walks
+ * down to their instruments and samples, then
+ * writes those with only the sample data they
+ * use [read by seeking, never the whole file].
+ */
+bool SoundfontSubset::extract(const string sourcePath,
+  const set<int>& programs, const string subsetPath) {
+  ifstream source(sourcePath.c_str(), ios::binary);
+  if (!source) return false;
+
+  char header[12];
+  if (!source.read(header, 12)) return false;
+  if (memcmp(header, "RIFF", 4) || memcmp(header + 8, "sfbk", 4)) return false;
+  streamoff riffEnd = 8 + (streamoff) readLE(header + 4, 4);
+
+  vector<char> info;
+  streamoff smplStart = -1;
+  streamoff sm24Start = -1;
+  unsigned int smplSize = 0;
+  unsigned int sm24Size = 0;
+  map<string, Records> hydra;
+
+  // top level lists in any order
+  streamoff position = 12;
+  while (position + 12 <= riffEnd) {
+    char list[12];
+    source.seekg(position);
+    if (!source.read(list, 12)) return false;
+
+    unsigned int listSize = readLE(list + 4, 4);
+    if (listSize < 4) return false;
+    streamoff listEnd = position + 8 + listSize;
+    string type(list + 8, 4);
+
+    if (memcmp(list, "LIST", 4) == 0 && type == "INFO") {
+      info.resize(listSize - 4); // copied as is
+      if (!info.empty() && !source.read(&info[0], info.size())) return false;
+    }
+
+    else if (memcmp(list, "LIST", 4) == 0 && (type == "sdta" || type == "pdta")) {
+      streamoff chunkStart = position + 12;
+      while (chunkStart + 8 <= listEnd) {
+        char chunk[8];
+        source.seekg(chunkStart);
+        if (!source.read(chunk, 8)) return false;
+
+        string id(chunk, 4);
+        unsigned int size = readLE(chunk + 4, 4);
+        streamoff dataStart = chunkStart + 8;
+
+        // sample data is only located here
+        if (id == "smpl") { smplStart = dataStart; smplSize = size; }
+        else if (id == "sm24") { sm24Start = dataStart; sm24Size = size; }
+        else if (type == "pdta") {
+          Records& records = hydra[id];
+          records.data.resize(size);
+          if (size > 0 && !source.read(&records.data[0], size)) return false;
+        }
+
+        chunkStart = dataStart + size + (size % 2);
+      }
+    }
+
+    position = listEnd + (listSize % 2);
+  }
+
+  if (smplStart < 0) return false;
+
+  // every hydra chunk must be whole records
+  const char* names[] = { "phdr", "pbag", "pmod", "pgen", "inst", "ibag", "imod", "igen", "shdr" };
+  const int sizes[] = { PHDR_SIZE, BAG_SIZE, MOD_SIZE, GEN_SIZE, INST_SIZE,
+    BAG_SIZE, MOD_SIZE, GEN_SIZE, SHDR_SIZE };
+  for (int i = 0; i < 9; i += 1) {
+    Records& records = hydra[names[i]];
+    if (records.data.size() % sizes[i]) return false;
+    records.size = sizes[i];
+    records.count = records.data.size() / sizes[i];
+  }
+
+  Records& phdr = hydra["phdr"]; Records& pbag = hydra["pbag"];
+  Records& pmod = hydra["pmod"]; Records& pgen = hydra["pgen"];
+  Records& inst = hydra["inst"]; Records& ibag = hydra["ibag"];
+  Records& imod = hydra["imod"]; Records& igen = hydra["igen"];
+  Records& shdr = hydra["shdr"];
+
+  if (!checkLevel(phdr, PHDR_BAG, pbag, pmod, pgen)) return false;
+  if (!checkLevel(inst, INST_BAG, ibag, imod, igen)) return false;
+  if (shdr.count < 1) return false;
+
+  // melodic presets only [nothing plays drums]
+  vector<int> presets;
+  for (int i = 0; i + 1 < phdr.count; i += 1)
+    if (field(phdr, i, 22, 2) == 0 && programs.count(field(phdr, i, 20, 2)))
+      presets.push_back(i);
+  if (presets.empty()) return false;
+
+  set<int> instruments;
+  collectLinks(phdr, PHDR_BAG, pbag, pgen, presets, GEN_INSTRUMENT, instruments);
+
+  // kept in file order so new indices are dense
+  vector<int> keptInstruments;
+  vector<int> instrumentRemap(inst.count, -1);
+  for (set<int>::iterator it = instruments.begin(); it != instruments.end(); ++it) {
+    if (*it >= inst.count - 1) return false;
+    instrumentRemap[*it] = keptInstruments.size();
+    keptInstruments.push_back(*it);
+  }
+
+  set<int> samples;
+  collectLinks(inst, INST_BAG, ibag, igen, keptInstruments, GEN_SAMPLE_ID, samples);
+
+  // stereo partners come along even when no zone names them
+  vector<int> unvisited(samples.begin(), samples.end());
+  while (!unvisited.empty()) {
+    int sample = unvisited.back();
+    unvisited.pop_back();
+    if (sample >= shdr.count - 1) return false;
+
+    unsigned int link = field(shdr, sample, 42, 2);
+    unsigned int sampleType = field(shdr, sample, 44, 2);
+    if ((sampleType & ~ROM_SAMPLE) == MONO_SAMPLE) continue;
+    if (link < (unsigned int) shdr.count - 1 && samples.insert(link).second)
+      unvisited.push_back(link);
+  }
+
+  vector<int> sampleRemap(shdr.count, -1);
+  int nextSample = 0;
+  for (set<int>::iterator it = samples.begin(); it != samples.end(); ++it)
+    sampleRemap[*it] = nextSample++;
+
+  // only when it covers every sample point
+  bool has24 = sm24Start >= 0 && sm24Size >= smplSize / 2;
+
+  Records newShdr = { vector<char>(), SHDR_SIZE, 0 };
+  vector<char> smpl;
+  vector<char> sm24;
+
+  for (set<int>::iterator it = samples.begin(); it != samples.end(); ++it) {
+    int sample = append(newShdr, shdr, *it);
+    unsigned int link = field(shdr, *it, 42, 2);
+    bool linked = link < (unsigned int) shdr.count && sampleRemap[link] >= 0;
+    patch(newShdr, sample, 42, linked ? sampleRemap[link] : 0, 2);
+
+    // offsets into ROM, not this file
+    if (field(shdr, *it, 44, 2) & ROM_SAMPLE) continue;
+
+    unsigned int start = field(shdr, *it, 20, 4);
+    unsigned int end = field(shdr, *it, 24, 4);
+    if (start > end || end > smplSize / 2) return false;
+
+    unsigned int length = end - start;
+    unsigned int offset = smpl.size() / 2;
+    smpl.resize(smpl.size() + 2 * (length + SAMPLE_PAD), 0);
+    source.seekg(smplStart + 2 * (streamoff) start);
+    if (length > 0 && !source.read(&smpl[2 * offset], 2 * length)) return false;
+
+    if (has24) { // low bytes line up point for point
+      sm24.resize(offset + length + SAMPLE_PAD, 0);
+      source.seekg(sm24Start + (streamoff) start);
+      if (length > 0 && !source.read(&sm24[offset], length)) return false;
+    }
+
+    // loops move with the sample [wrapping keeps them relative]
+    patch(newShdr, sample, 20, offset, 4);
+    patch(newShdr, sample, 24, offset + length, 4);
+    patch(newShdr, sample, 28, field(shdr, *it, 28, 4) - start + offset, 4);
+    patch(newShdr, sample, 32, field(shdr, *it, 32, 4) - start + offset, 4);
+  }
+
+  append(newShdr, shdr, shdr.count - 1);
+
+  Records newPhdr = { vector<char>(), PHDR_SIZE, 0 };
+  Records newPbag = { vector<char>(), BAG_SIZE, 0 };
+  Records newPmod = { vector<char>(), MOD_SIZE, 0 };
+  Records newPgen = { vector<char>(), GEN_SIZE, 0 };
+  copyLevel(phdr, PHDR_BAG, pbag, pmod, pgen, presets, GEN_INSTRUMENT,
+    instrumentRemap, newPhdr, newPbag, newPmod, newPgen);
+
+  Records newInst = { vector<char>(), INST_SIZE, 0 };
+  Records newIbag = { vector<char>(), BAG_SIZE, 0 };
+  Records newImod = { vector<char>(), MOD_SIZE, 0 };
+  Records newIgen = { vector<char>(), GEN_SIZE, 0 };
+  copyLevel(inst, INST_BAG, ibag, imod, igen, keptInstruments, GEN_SAMPLE_ID,
+    sampleRemap, newInst, newIbag, newImod, newIgen);
+
+  vector<char> sdta;
+  appendChunk(sdta, "smpl", smpl);
+  if (has24) appendChunk(sdta, "sm24", sm24);
+
+  vector<char> pdta;
+  appendChunk(pdta, "phdr", newPhdr.data);
+  appendChunk(pdta, "pbag", newPbag.data);
+  appendChunk(pdta, "pmod", newPmod.data);
+  appendChunk(pdta, "pgen", newPgen.data);
+  appendChunk(pdta, "inst", newInst.data);
+  appendChunk(pdta, "ibag", newIbag.data);
+  appendChunk(pdta, "imod", newImod.data);
+  appendChunk(pdta, "igen", newIgen.data);
+  appendChunk(pdta, "shdr", newShdr.data);
+
+  vector<char> body;
+  body.insert(body.end(), header + 8, header + 12);
+  appendList(body, "INFO", info);
+  appendList(body, "sdta", sdta);
+  appendList(body, "pdta", pdta);
+
+  vector<char> riff;
+  riff.reserve(body.size() + 8);
+  appendChunk(riff, "RIFF", body);
+
+  ofstream out(subsetPath.c_str(), ios::binary);
+  out.write(&riff[0], riff.size());
+  return out.good();
+}
+
+/**
+ * Function: prepare
+ * -----------------
+ * Hashes the programs with the source's size
+ * and time into a cache name. A hit is used
+ * as is, and a miss is extracted to the side
+ * and renamed in so a crash halfway never
+ * leaves a broken soundfont to be loaded.
+ */
+string SoundfontSubset::prepare(const string sourcePath, const set<int>& programs) {
+  struct stat sourceInfo;
+  if (programs.empty()) return sourcePath;
+  if (stat(sourcePath.c_str(), &sourceInfo) != 0) return sourcePath;
+
+  vector<long long> key(programs.begin(), programs.end());
+  key.push_back(sourceInfo.st_size);
+  key.push_back(sourceInfo.st_mtime);
+
+  // FNV-1a over every byte of the key
+  unsigned int hash = 2166136261u;
+  for (size_t i = 0; i < key.size(); i += 1) {
+    for (int byte = 0; byte < 8; byte += 1) {
+      hash ^= (key[i] >> (8 * byte)) & 0xFF;
+      hash *= 16777619u;
+    }
+  }
+
+  string base = sourcePath;
+  size_t extension = base.rfind(".sf2");
+  if (extension != string::npos && extension + 4 == base.size()) base.erase(extension);
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), ".subset-%08x.sf2", hash);
+  string subsetPath = base + suffix;
+
+  struct stat subsetInfo;
+  if (stat(subsetPath.c_str(), &subsetInfo) == 0) return subsetPath;
+
+  string partialPath = subsetPath + ".partial";
+  if (extract(sourcePath, programs, partialPath) &&
+    rename(partialPath.c_str(), subsetPath.c_str()) == 0) {
+    removeStale(base, subsetPath);
+    return subsetPath;
+  }
+
+  cerr << "Cannot subset font file: " << sourcePath << "." << endl;
+  remove(partialPath.c_str());
+  return sourcePath;
+}
+
+/**
+ * Function: removeStale
+ * ---------------------
+ * Deletes the cached subsets of a source
+ * other than the one just written, since
+ * their programs or source have changed.
+ * Partial ones may still be in progress.
+ */
+void SoundfontSubset::removeStale(const string base, const string subsetPath) {
+  size_t slash = base.rfind('/');
+  string directory = slash == string::npos ? "." : base.substr(0, slash + 1);
+  string prefix = base.substr(slash == string::npos ? 0 : slash + 1) + ".subset-";
+
+  DIR* listing = opendir(directory.c_str());
+  if (listing == NULL) return;
+
+  // the prefix, eight hex digits, and .sf2
+  size_t nameLength = prefix.size() + 12;
+  struct dirent* entry;
+
+  while ((entry = readdir(listing)) != NULL) {
+    string name = entry -> d_name;
+    if (name.size() != nameLength || name.compare(0, prefix.size(), prefix) != 0) continue;
+    if (name.compare(nameLength - 4, 4, ".sf2") != 0) continue;
+
+    string path = slash == string::npos ? name : directory + name;
+    if (path != subsetPath) remove(path.c_str());
+  }
+
+  closedir(listing);
+}
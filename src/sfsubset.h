@@ -0,0 +1,38 @@
+/**
+ * File: sfsubset.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Writes a smaller soundfont holding
+ * only the presets we play, so load
+ * time and memory follow what is used.
+ */
+
+#ifndef SFSUBSET_H
+#define SFSUBSET_H
+
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+// SF2 preset extractor
+class SoundfontSubset {
+  public:
+    // write a soundfont with only the bank 0 presets for some programs
+    // and the instruments, samples, and sample data they reference
+    static bool extract(const string sourcePath, const set<int>& programs,
+      const string subsetPath);
+
+    // path of a cached subset for some programs next to the source [named
+    // by the programs and the source's size and time so stale ones are never
+    // used and deleted once a new one is written], extracting it first if
+    // needed, or the source if that fails
+    static string prepare(const string sourcePath, const set<int>& programs);
+
+  protected:
+    // delete every other cached subset of a source
+    static void removeStale(const string base, const string subsetPath);
+};
+
+// guard
+#endif
@@ -7,16 +7,133 @@
  */
 
 #include "synthesizer.h"
+#include <string.h>
 #include <iostream>
 using namespace std;
 
+// enough for fast chords from every thread
+const unsigned int COMMAND_CAPACITY = 1024;
+// live blocks are rendered in chunks of this
+const unsigned int LIVE_BUFFER_FRAMES = 4096;
+// most messages a block handler can schedule
+const unsigned int TIMED_CAPACITY = 1024;
+// synthesize renders in chunks of at most this
+const unsigned int SHARD_BUFFER_FRAMES = 4096;
+
+// channel for warming past the 16 layers can use
+// [FluidSynth only allocates them in groups of 16]
+const int WARM_CHANNEL = MASTER_CHANNELS;
+const int MIDI_CHANNELS = 2 * MASTER_CHANNELS;
+// every few keys at a soft and a hard velocity
+// reaches each key and velocity split of a preset
+const int WARM_KEY_STEP = 4;
+const int WARM_VELOCITIES[] = { 40, 127 };
+// frames rendered per warming pass
+const unsigned int WARM_FRAMES = 256;
+
+/**
+ * Constructor: ShardWorker
+ * ------------------------
+ * Binds a worker to one shard.
+ */
+ShardWorker::ShardWorker(Synthesizer* synth, int index)
+  : owner(synth), shard(index), frames(0),
+    result(true), quitting(false) {}
+
+/**
+ * Function: begin
+ * ---------------
+ * Wakes the worker to render a
+ * block of its shard.
+ */
+void ShardWorker::begin(unsigned int numFrames) {
+  frames = numFrames;
+  startEvent.set();
+}
+
+/**
+ * Function: finish
+ * ----------------
+ * Waits for the worker to finish
+ * the block started by begin.
+ */
+bool ShardWorker::finish() {
+  doneEvent.wait();
+  return result;
+}
+
+/**
+ * Function: quit
+ * --------------
+ * Wakes the worker one last
+ * time and joins its thread.
+ */
+void ShardWorker::quit() {
+  quitting = true;
+  startEvent.set();
+  waitForThread(true);
+}
+
+/**
+ * Function: threadedFunction
+ * --------------------------
+ * Renders a block each time
+ * the render thread asks.
+ */
+void ShardWorker::threadedFunction() {
+  while (true) {
+    startEvent.wait();
+    if (quitting) return;
+
+    float* buffer = owner -> shardBuffers[shard];
+    result = owner -> renderShard(shard, buffer, frames);
+    doneEvent.set();
+  }
+}
+
+/**
+ * Constructor: ShardLoader
+ * ------------------------
+ * Binds a loader to one shard.
+ */
+ShardLoader::ShardLoader(Synthesizer* synth, int index, const char* fontPath)
+  : owner(synth), shard(index), path(fontPath), result(false) {}
+
+/**
+ * Function: getResult
+ * -------------------
+ * Whether the shard loaded.
+ */
+bool ShardLoader::getResult() {
+  // just an accessor because style
+  return result;
+}
+
+/**
+ * Function: threadedFunction
+ * --------------------------
+ * Loads the soundfont once.
+ */
+void ShardLoader::threadedFunction() {
+  result = owner -> loadShard(shard, path);
+}
+
 /**
  * Constructor: Synthesizer
  * ------------------------
  * Sets FluidSynth objects to NULL.
  */
 Synthesizer::Synthesizer()
-  : settings(NULL), synth(NULL), driver(NULL) {}
+  : synth(NULL), settings(NULL), driver(NULL),
+    commands(COMMAND_CAPACITY), loading(false), rendering(false),
+    loadedShards(0), programsHeld(false), liveBuffer(NULL), liveFrames(0),
+    blockHandler(NULL), blockData(NULL), frameCount(0), frameMicros(0),
+    blockFrames(0), sampleRate(0), latencyHistogram(NULL) {
+  // never grows on the render thread
+  timedCommands.reserve(TIMED_CAPACITY);
+  for (int i = 0; i < 16; i += 1)
+    heldPrograms[i] = -1;
+}
 
 /**
  * Destructor: Synthesizer
@@ -27,14 +144,32 @@ Synthesizer::~Synthesizer() {
   // lock synth
   synthLock.lock();
 
-  // clean up FluidSynth objects
-  if (synth) delete_fluid_synth(synth);
-  if (settings) delete_fluid_settings(settings);
+  // stop the driver first since it calls back into us
   if (driver) delete_fluid_audio_driver(driver);
 
+  // then the shard workers
+  for (int i = 0; i < workers.size(); i += 1) {
+    if (workers[i] == NULL) continue;
+    workers[i] -> quit();
+    delete workers[i];
+  }
+
+  for (int i = 0; i < shards.size(); i += 1)
+    delete_fluid_synth(shards[i]);
+  for (int i = 0; i < shardBuffers.size(); i += 1)
+    delete[] shardBuffers[i];
+
+  workers.clear();
+  shards.clear();
+  shardBuffers.clear();
+
+  if (settings) delete_fluid_settings(settings);
+  if (liveBuffer) delete[] liveBuffer;
+
   synth = NULL;
   settings = NULL;
   driver = NULL;
+  liveBuffer = NULL;
 
   // unlock synth
   synthLock.unlock();
@@ -44,9 +179,10 @@ Synthesizer::~Synthesizer() {
  * Function: init
  * --------------
  * Sets synthesizer sampling rate
- * and max polyphony voices.
+ * and max polyphony voices. Each
+ * shard gets its own polyphony.
  */
-bool Synthesizer::init(int rate, int polyphony, bool live) {
+bool Synthesizer::init(int rate, int polyphony, bool live, int shardCount) {
   if (synth != NULL) {
     // avoid potential reinitialization of synth
     cerr << "Synthesizer already initialized." << endl;
@@ -63,19 +199,55 @@ bool Synthesizer::init(int rate, int polyphony, bool live) {
   settings = new_fluid_settings();
   // set sample rate in fluidsynth settings
   fluid_settings_setnum(settings, (char*) "synth.sample-rate", (double) rate);
+  sampleRate = rate; // used for block timing
 
   // set polyphony and bound
   if (polyphony <= 0) polyphony = 1;
   else if (polyphony > 256) polyphony = 256;
   fluid_settings_setint(settings, (char*) "synth.polyphony", polyphony);
 
-  // instantiate the synth
-  synth = new_fluid_synth(settings);
+  // one audio group per channel so the master
+  // bus can mix them at their own gains
+  fluid_settings_setint(settings, (char*) "synth.audio-groups", MASTER_CHANNELS);
+  fluid_settings_setint(settings, (char*) "synth.audio-channels", MASTER_CHANNELS);
+  fluid_settings_setint(settings, (char*) "synth.effects-channels", MASTER_EFFECTS);
+  fluid_settings_setint(settings, (char*) "synth.midi-channels", MIDI_CHANNELS);
+  masterBus.init(rate);
+
+  // sample data is mlocked as it loads so
+  // switching never waits on a page fault
+  fluid_settings_setint(settings, (char*) "synth.lock-memory", 1);
+
+  // instantiate the synths
+  if (shardCount < 1) shardCount = 1;
+  for (int i = 0; i < shardCount; i += 1)
+    shards.push_back(new_fluid_synth(settings));
+  synth = shards[0];
+
+  // per channel targets and the channels
+  // each shard owns [channel % shardCount]
+  channelBuffers.resize(shardCount);
+  shardMasks.assign(shardCount, 0);
+  for (int i = 0; i < shardCount; i += 1)
+    channelBuffers[i].allocate(SHARD_BUFFER_FRAMES);
+  for (int i = 0; i < MASTER_CHANNELS; i += 1)
+    shardMasks[i % shardCount] |= 1u << i;
+
+  // a single shard renders straight into the output
+  for (int i = 0; shardCount > 1 && i < shardCount; i += 1) {
+    shardBuffers.push_back(new float[2 * SHARD_BUFFER_FRAMES]);
+    workers.push_back(i == 0 ? NULL : new ShardWorker(this, i));
+    if (workers[i]) workers[i] -> startThread();
+  }
 
   if (live) { // go ahead and play FluidSynth live if live mode has been set
     char* defaultDriver = fluid_settings_getstr_default(settings, "audio.driver");
     fluid_settings_setstr(settings, "audio.driver", defaultDriver);
-    driver = new_fluid_audio_driver(settings, synth);
+
+    // render through synthesize so queued commands get applied
+    liveFrames = LIVE_BUFFER_FRAMES;
+    liveBuffer = new float[2 * liveFrames];
+    driver = new_fluid_audio_driver2(settings, &Synthesizer::audioCallback, this);
   }
 
   // unlock synth
@@ -88,27 +260,140 @@ bool Synthesizer::init(int rate, int polyphony, bool live) {
  * --------------
  * Loads a SoundFont file into the
  * synthesizer and overwrite presets.
+ * FluidSynth cannot share samples
+ * so every shard holds a copy.
  */
 bool Synthesizer::load(const char* path) {
   if(synth == NULL) return false;
 
   // lock synth
   synthLock.lock();
+  loadedShards = 0;
+
+  // render thread goes quiet, but a block that
+  // started before it saw the flag has to end
+  // before any shard is touched [see renderBlock]
+  loading = true;
+  __sync_synchronize();
+  while (rendering) ofSleepMillis(1);
+
+  // every shard parses its own copy of the
+  // soundfont so they all load in parallel
+  vector<ShardLoader*> loaders;
+  for (int i = 1; i < shards.size(); i += 1) {
+    loaders.push_back(new ShardLoader(this, i, path));
+    loaders.back() -> startThread();
+  }
+
+  bool success = loadShard(0, path);
+  for (int i = 0; i < loaders.size(); i += 1) {
+    loaders[i] -> waitForThread(false);
+    success = loaders[i] -> getResult() && success;
+    delete loaders[i];
+  }
+
+  // shards are written before the render thread sees them
+  __sync_synchronize();
+  loading = false;
+
+  // unlock synth
+  synthLock.unlock();
+  return success;
+}
 
+/**
+ * Function: loadShard
+ * -------------------
+ * Loads the soundfont into one shard
+ * and counts it towards progress.
+ */
+bool Synthesizer::loadShard(int shard, const char* path) {
   // load soundfont and catch any errors in doing so
-  if (fluid_synth_sfload(synth, path, true) == -1) {
+  if (fluid_synth_sfload(shards[shard], path, true) == -1) {
     cerr << "Cannot load font file: " << path << "." << endl;
-
-    // unlock synth
-    synthLock.unlock();
     return false;
   }
 
-  // unlock synth
-  synthLock.unlock();
+  warmShard(shard);
+  __sync_add_and_fetch(&loadedShards, 1);
   return true;
 }
 
+/**
+ * Function: setWarmPrograms
+ * -------------------------
+ * Sets the programs to warm
+ * after every later load.
+ */
+void Synthesizer::setWarmPrograms(const set<int>& programs) {
+  // just a mutator because style
+  warmPrograms = programs;
+}
+
+/**
+ * Function: warmShard
+ * -------------------
+ * Plays every warm program across its keys
+ * and velocities on the spare channel into
+ * scratch and throws the audio away, so the
+ * first note after a switch finds its samples
+ * resident and cached. Only called once load
+ * has the shards from the render thread.
+ */
+void Synthesizer::warmShard(int shard) {
+  if (warmPrograms.empty()) return;
+  fluid_synth_t* target = shards[shard];
+
+  // never the render targets
+  ChannelBuffers channels;
+  channels.allocate(WARM_FRAMES);
+
+  // nearly silent and dry so no tail outlives the warm up
+  fluid_synth_cc(target, WARM_CHANNEL, 7, 1); // volume
+  fluid_synth_cc(target, WARM_CHANNEL, 91, 0); // reverb
+  fluid_synth_cc(target, WARM_CHANNEL, 93, 0); // chorus
+
+  set<int>::iterator it;
+  for (it = warmPrograms.begin(); it != warmPrograms.end(); ++it) {
+    if (fluid_synth_program_change(target, WARM_CHANNEL, *it) != FLUID_OK) continue;
+
+    for (int i = 0; i < 2; i += 1) {
+      for (int key = 0; key < 128; key += WARM_KEY_STEP)
+        fluid_synth_noteon(target, WARM_CHANNEL, key, WARM_VELOCITIES[i]);
+
+      // never mixed so none of it is heard
+      fluid_synth_nwrite_float(target, WARM_FRAMES, channels.left,
+        channels.right, channels.effectsLeft, channels.effectsRight);
+      fluid_synth_all_sounds_off(target, WARM_CHANNEL);
+    }
+  }
+
+  // back to FluidSynth's channel defaults
+  fluid_synth_cc(target, WARM_CHANNEL, 7, 100);
+  fluid_synth_cc(target, WARM_CHANNEL, 91, 0);
+  fluid_synth_program_change(target, WARM_CHANNEL, 0);
+}
+
+/**
+ * Function: getLoadedShards
+ * -------------------------
+ * Get the shards loaded so far.
+ */
+int Synthesizer::getLoadedShards() {
+  // just an accessor because style
+  return loadedShards;
+}
+
+/**
+ * Function: isLoading
+ * -------------------
+ * Whether a load is running.
+ */
+bool Synthesizer::isLoading() {
+  // just an accessor because style
+  return loading;
+}
+
 /**
  * Function: setInstrument
  * -----------------------
@@ -119,9 +404,8 @@ void Synthesizer::setInstrument(int channel, int program) {
   if(synth == NULL) return;
   if(program < 0 || program > 127) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_program_change(synth, channel, program);
-  synthLock.unlock(); // unlock synth
+  // applied at the next render block
+  sendCommand(PROGRAM_COMMAND, channel, program, 0);
 }
 
 /**
@@ -133,9 +417,8 @@ void Synthesizer::controlChange(int channel, int dataTwo, int dataThree) {
   if (synth == NULL) return;
   if (dataTwo < 0 || dataTwo > 127) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_cc(synth, channel, dataTwo, dataThree);
-  synthLock.unlock(); // unlock synth
+  // applied at the next render block
+  sendCommand(CONTROL_COMMAND, channel, dataTwo, dataThree);
 }
 
 /**
@@ -153,19 +436,13 @@ void Synthesizer::noteOn(int channel, float pitch, int velocity) {
   // find the bend difference
   // float diff = pitch - pitchI;
 
-  // lock synth
-  synthLock.lock();
-  
   // if bend needed
   // if (diff != 0)
     // apply the necessary bend to the note [TODO: does this need a reset]
-    // fluid_synth_pitch_bend(synth, channel, (int) (8192 + diff * 8191));
-
-  // sound note with the given velocity
-  fluid_synth_noteon(synth, channel, pitch, velocity);
+    // sendCommand(BEND_COMMAND, channel, 0, (int) (8192 + diff * 8191));
 
-  // unlock synth
-  synthLock.unlock();
+  // sound note with the given velocity at the next render block
+  sendCommand(NOTE_ON_COMMAND, channel, (int) pitch, velocity);
 }
 
 /**
@@ -178,14 +455,8 @@ void Synthesizer::pitchBend(int channel, float pitchDiff) {
   // sanity check on synth
   if (synth == NULL) return;
 
-  // lock synth
-  synthLock.lock();
-
   // pitch bend [TODO: figure out exactly what pitchDiff means]
-  fluid_synth_pitch_bend(synth, channel, (int) (8192 + pitchDiff * 8191));
-
-  // unlock synth
-  synthLock.unlock();
+  sendCommand(BEND_COMMAND, channel, 0, (int) (8192 + pitchDiff * 8191));
 }
 
 /**
@@ -198,9 +469,8 @@ void Synthesizer::noteOff(int channel, int pitch) {
   // sanity check on synth
   if (synth == NULL) return;
 
-  synthLock.lock(); // lock synth
-  fluid_synth_noteoff(synth, channel, pitch);
-  synthLock.unlock(); // unlock synth
+  // applied at the next render block
+  sendCommand(NOTE_OFF_COMMAND, channel, pitch, 0);
 }
 
 /**
@@ -218,15 +488,432 @@ void Synthesizer::allNotesOff(int channel) {
  * --------------------
  * Synthesizes a stereo buffer of
  * samples for use external to synth.
+ * Never blocks on a mutex.
  */
 bool Synthesizer::synthesize(float* buffer, unsigned int numFrames) {
   // sanity check on synth
   if (synth == NULL) return false;
+  bool success = true;
+
+  // shard buffers are a fixed size
+  for (unsigned int done = 0; done < numFrames; ) {
+    unsigned int frames = min(numFrames - done, SHARD_BUFFER_FRAMES);
+    success = renderBlock(buffer + 2 * done, frames) && success;
+    done += frames;
+  }
+
+  return success;
+}
+
+/**
+ * Function: renderBlock
+ * ---------------------
+ * Applies queued messages, runs the block
+ * handler, then renders every shard [the
+ * first one on this thread] and mixes.
+ */
+bool Synthesizer::renderBlock(float* buffer, unsigned int numFrames) {
+  // announce the block before checking for a load
+  // so either load waits for it or it sees loading
+  rendering = true;
+  __sync_synchronize();
+
+  if (loading) {
+    rendering = false;
+    return renderLoading(buffer, numFrames);
+  }
+
+  // programs asked for during the load
+  if (programsHeld) {
+    for (int i = 0; i < 16; i += 1) {
+      SynthCommand program = {PROGRAM_COMMAND, i, heldPrograms[i], 0, 0};
+      if (heldPrograms[i] != -1) applyCommand(program);
+      heldPrograms[i] = -1;
+    }
+
+    programsHeld = false;
+  }
 
-  synthLock.lock(); // lock synth
-  int retVal = fluid_synth_write_float(synth, numFrames, buffer, 0, 2, buffer, 1, 2);
-  synthLock.unlock(); // unlock synth
+  // catch up on note events
+  drainCommands();
+
+  // let the block handler schedule inside this block but never
+  // wait for it [it is only held while the handler is swapped]
+  timedCommands.clear();
+  if (blockLock.tryLock()) {
+    if (blockHandler) blockHandler(blockData, frameCount, numFrames);
+    blockLock.unlock();
+  }
+
+  // insertion sort by offset [note offs first] since it
+  // is usually sorted already and allocates nothing
+  for (int i = 1; i < (int) timedCommands.size(); i += 1) {
+    TimedCommand timed = timedCommands[i];
+    int j = i - 1;
+
+    for (; j >= 0; j -= 1) {
+      TimedCommand& other = timedCommands[j];
+      if (other.offset < timed.offset) break;
+      if (other.offset == timed.offset && (other.command.type == NOTE_OFF_COMMAND
+        || timed.command.type != NOTE_OFF_COMMAND)) break;
+      timedCommands[j + 1] = other;
+    }
+
+    timedCommands[j + 1] = timed;
+  }
+
+  bool success = true;
+  if (shards.size() == 1) success = renderShard(0, buffer, numFrames);
+
+  else { // other shards render while we do the first
+    for (int i = 1; i < workers.size(); i += 1)
+      workers[i] -> begin(numFrames);
+
+    success = renderShard(0, shardBuffers[0], numFrames);
+    for (int i = 1; i < workers.size(); i += 1)
+      success = workers[i] -> finish() && success;
+
+    // mix every shard into the output
+    memcpy(buffer, shardBuffers[0], 2 * numFrames * sizeof(float));
+    for (int i = 1; i < shardBuffers.size(); i += 1) {
+      float* shardBuffer = shardBuffers[i];
+      for (unsigned int j = 0; j < 2 * numFrames; j += 1)
+        buffer[j] += shardBuffer[j];
+    }
+  }
+
+  // master bus after the mix
+  masterBus.process(buffer, numFrames);
+
+  // done with the shards
+  __sync_synchronize();
+  rendering = false;
+
+  frameCount += numFrames;
+  frameMicros = ofGetElapsedTimeMicros();
+  blockFrames = numFrames;
+  return success;
+}
+
+/**
+ * Function: renderLoading
+ * -----------------------
+ * Stands in for renderBlock while a soundfont
+ * loads. The block handler still runs so the
+ * sequencer keeps time, but notes are dropped
+ * and programs are held for later.
+ */
+bool Synthesizer::renderLoading(float* buffer, unsigned int numFrames) {
+  SynthCommand command;
+  while (commands.pop(command)) {
+    if (command.type != PROGRAM_COMMAND) continue;
+    heldPrograms[command.channel % 16] = command.dataOne;
+    programsHeld = true;
+  }
+
+  timedCommands.clear();
+  if (blockLock.tryLock()) {
+    if (blockHandler) blockHandler(blockData, frameCount, numFrames);
+    blockLock.unlock();
+  }
+
+  // nothing to play yet
+  timedCommands.clear();
+  memset(buffer, 0, 2 * numFrames * sizeof(float));
+
+  frameCount += numFrames;
+  frameMicros = ofGetElapsedTimeMicros();
+  blockFrames = numFrames;
+  return true;
+}
+
+/**
+ * Function: renderShard
+ * ---------------------
+ * Renders one shard up to each timed message
+ * for its channels and then applies it [and
+ * FluidSynth still quantizes voice starts to
+ * its 64 frame internal block].
+ */
+bool Synthesizer::renderShard(int shard, float* buffer, unsigned int numFrames) {
+  unsigned int done = 0; // frames so far
+  int retVal = 0; // any failure sticks
+
+  for (int i = 0; i < (int) timedCommands.size(); i += 1) {
+    if (getShard(timedCommands[i].command.channel) != shard) continue;
+
+    unsigned int offset = timedCommands[i].offset;
+    if (offset > done) {
+      float* segment = buffer + 2 * done; // interleaved stereo
+      retVal |= writeShard(shard, segment, offset - done);
+      done = offset;
+    }
+
+    applyCommand(timedCommands[i].command);
+  }
+
+  if (numFrames > done) { // rest of the block
+    float* segment = buffer + 2 * done; // interleaved stereo
+    retVal |= writeShard(shard, segment, numFrames - done);
+  }
 
-  // return success
   return retVal == 0;
 }
+
+/**
+ * Function: writeShard
+ * --------------------
+ * Renders a shard one channel per audio
+ * group and mixes the channels it owns
+ * at their gains into interleaved frames.
+ */
+int Synthesizer::writeShard(int shard, float* buffer, unsigned int numFrames) {
+  ChannelBuffers& channels = channelBuffers[shard];
+  int retVal = fluid_synth_nwrite_float(shards[shard], numFrames, channels.left,
+    channels.right, channels.effectsLeft, channels.effectsRight);
+  masterBus.mixChannels(buffer, channels, shardMasks[shard], numFrames);
+  return retVal;
+}
+
+/**
+ * Function: getShard
+ * ------------------
+ * Get the shard that owns
+ * a MIDI channel.
+ */
+int Synthesizer::getShard(int channel) {
+  // same routing for every message
+  return channel % shards.size();
+}
+
+/**
+ * Function: setChannelGain
+ * ------------------------
+ * Sets a channel's gain on the
+ * master bus [1.0 is unity].
+ */
+void Synthesizer::setChannelGain(int channel, float gain) {
+  // read by the render thread per block
+  masterBus.setChannelGain(channel, gain);
+}
+
+/**
+ * Function: getChannelGain
+ * ------------------------
+ * Get a channel's gain.
+ */
+float Synthesizer::getChannelGain(int channel) {
+  // just an accessor because style
+  return masterBus.getChannelGain(channel);
+}
+
+/**
+ * Function: getChannelRms
+ * -----------------------
+ * Get a channel's recent RMS level
+ * [lock free from any thread].
+ */
+float Synthesizer::getChannelRms(int channel) {
+  // just an accessor because style
+  return masterBus.getChannelRms(channel);
+}
+
+/**
+ * Function: getChannelPeak
+ * ------------------------
+ * Get a channel's recent peak.
+ */
+float Synthesizer::getChannelPeak(int channel) {
+  // just an accessor because style
+  return masterBus.getChannelPeak(channel);
+}
+
+/**
+ * Function: getLatency
+ * --------------------
+ * Get the frames the master
+ * bus delays the output.
+ */
+unsigned int Synthesizer::getLatency() {
+  // just an accessor because style
+  return masterBus.getLatency();
+}
+
+/**
+ * Function: getShardCount
+ * -----------------------
+ * Get the number of shards.
+ */
+int Synthesizer::getShardCount() {
+  // just an accessor because style
+  return shards.size();
+}
+
+/**
+ * Function: setBlockHandler
+ * -------------------------
+ * Registers a callback for the start of every
+ * render block. Waits for any handler call in
+ * progress so the old data can be destroyed.
+ */
+void Synthesizer::setBlockHandler(BlockHandler call, void* data) {
+  blockLock.lock();
+  blockHandler = call;
+  blockData = data;
+  blockLock.unlock();
+}
+
+/**
+ * Function: scheduleCommand
+ * -------------------------
+ * Schedules a message at a frame offset into
+ * the block being rendered. Only valid from
+ * inside a block handler.
+ */
+bool Synthesizer::scheduleCommand(unsigned int offset, int type, int channel, int dataOne, int dataTwo) {
+  // full means we would have to allocate
+  if (timedCommands.size() == TIMED_CAPACITY)
+    return false;
+
+  TimedCommand timed = {offset, {type, channel, dataOne, dataTwo, 0}};
+  timedCommands.push_back(timed);
+  return true;
+}
+
+/**
+ * Function: setLatencyHistogram
+ * -----------------------------
+ * Starts recording how long queued
+ * note ons wait to be applied.
+ */
+void Synthesizer::setLatencyHistogram(Histogram* histogram) {
+  // just a mutator because style
+  latencyHistogram = histogram;
+}
+
+/**
+ * Function: getSampleRate
+ * -----------------------
+ * Get the rate set in init.
+ */
+int Synthesizer::getSampleRate() {
+  // just an accessor because style
+  return sampleRate;
+}
+
+/**
+ * Function: getFrameCount
+ * -----------------------
+ * Get the number of frames
+ * rendered so far.
+ */
+unsigned long long Synthesizer::getFrameCount() {
+  // just an accessor because style
+  return frameCount;
+}
+
+/**
+ * Function: getFrameMicros
+ * ------------------------
+ * Get when the last block was done.
+ */
+unsigned long long Synthesizer::getFrameMicros() {
+  // just an accessor because style
+  return frameMicros;
+}
+
+/**
+ * Function: getBlockFrames
+ * ------------------------
+ * Get the last block size.
+ */
+unsigned int Synthesizer::getBlockFrames() {
+  // just an accessor because style
+  return blockFrames;
+}
+
+/**
+ * Function: sendCommand
+ * ---------------------
+ * Queues a MIDI message without
+ * locking. Safe from any thread.
+ */
+void Synthesizer::sendCommand(int type, int channel, int dataOne, int dataTwo) {
+  SynthCommand command = {type, channel, dataOne, dataTwo, ofGetElapsedTimeMicros()};
+
+  // dropping is better than stalling the audio thread
+  if (!commands.push(command)) // should be very rare
+    cerr << "Synthesizer command queue full." << endl;
+}
+
+/**
+ * Function: drainCommands
+ * -----------------------
+ * Applies every queued message. Only
+ * called from the render thread.
+ */
+void Synthesizer::drainCommands() {
+  SynthCommand command;
+  while (commands.pop(command)) {
+    // time from keypress to the moment FluidSynth hears about it
+    if (latencyHistogram && command.type == NOTE_ON_COMMAND)
+      latencyHistogram -> record(ofGetElapsedTimeMicros() - command.stamp);
+    applyCommand(command);
+  }
+}
+
+/**
+ * Function: applyCommand
+ * ----------------------
+ * Hands one message to FluidSynth.
+ * Only called from the render thread.
+ */
+void Synthesizer::applyCommand(const SynthCommand& command) {
+  int channel = command.channel;
+  fluid_synth_t* target = shards[getShard(channel)];
+
+  switch (command.type) {
+    case NOTE_ON_COMMAND:
+      fluid_synth_noteon(target, channel, command.dataOne, command.dataTwo);
+      break;
+    case NOTE_OFF_COMMAND:
+      fluid_synth_noteoff(target, channel, command.dataOne);
+      break;
+    case PROGRAM_COMMAND:
+      fluid_synth_program_change(target, channel, command.dataOne);
+      break;
+    case CONTROL_COMMAND:
+      fluid_synth_cc(target, channel, command.dataOne, command.dataTwo);
+      break;
+    case BEND_COMMAND:
+      fluid_synth_pitch_bend(target, channel, command.dataTwo);
+      break;
+  }
+}
+
+/**
+ * Static Function: audioCallback
+ * ------------------------------
+ * Renders a live block through synthesize
+ * and splits it into driver channels.
+ */
+int Synthesizer::audioCallback(void* data, int len, int nin, float** in, int nout, float** out) {
+  Synthesizer* current = (Synthesizer*) data; // data was passed as this
+  float* buffer = current -> liveBuffer;
+  int done = 0; // frames written
+
+  while (done < len) {
+    int frames = min(len - done, (int) current -> liveFrames);
+    current -> synthesize(buffer, frames);
+
+    // deinterleave into the driver buffers
+    for (int i = 0; i < frames; i += 1) {
+      out[0][done + i] = buffer[2 * i];
+      out[1][done + i] = buffer[2 * i + 1];
+    }
+
+    done += frames;
+  }
+
+  return 0;
+}
@@ -9,18 +9,115 @@
 #ifndef SYNTHESIZER_H
 #define SYNTHESIZER_H
 
+#include <set>
 #include <fluidsynth.h>
+#include "Poco/Event.h"
+#include "ringbuffer.h"
+#include "histogram.h"
+#include "masterbus.h"
 #include "ofMain.h"
 
+// kinds of queued synth messages
+enum SynthCommandType {
+  NOTE_ON_COMMAND,
+  NOTE_OFF_COMMAND,
+  PROGRAM_COMMAND,
+  CONTROL_COMMAND,
+  BEND_COMMAND
+};
+
+// a MIDI message waiting to be
+// applied by the render thread
+struct SynthCommand {
+  int type; // SynthCommandType
+  int channel; // MIDI channel
+  int dataOne; // pitch, program, or control
+  int dataTwo; // velocity, value, or bend
+  unsigned long long stamp; // queued at [micros]
+};
+
+// a message due partway into a block
+struct TimedCommand {
+  unsigned int offset; // frames into block
+  SynthCommand command;
+};
+
+// called on the render thread at the start of each block with the
+// frame count so far and block size [used for sample accurate timing]
+typedef void (*BlockHandler)(void*, unsigned long long, unsigned int);
+
+// see below
+class Synthesizer;
+
+// renders one synth shard on its own
+// thread for every block [shards 1 up]
+class ShardWorker : public ofThread {
+  public:
+    ShardWorker(Synthesizer* owner, int shard);
+
+    // start rendering a block [render thread]
+    void begin(unsigned int numFrames);
+    // wait for that block and get success
+    bool finish();
+    // leave the thread loop and join
+    void quit();
+
+  protected:
+    void threadedFunction();
+
+    Synthesizer* owner;
+    int shard;
+
+    // current block
+    unsigned int frames;
+    bool result;
+    volatile bool quitting;
+
+    // handoff with the render thread
+    Poco::Event startEvent;
+    Poco::Event doneEvent;
+};
+
+// loads the soundfont into one synth
+// shard so every shard loads at once
+class ShardLoader : public ofThread {
+  public:
+    ShardLoader(Synthesizer* owner, int shard, const char* path);
+    bool getResult();
+
+  protected:
+    void threadedFunction();
+
+    Synthesizer* owner;
+    int shard;
+    const char* path;
+    bool result;
+};
+
 // plays MIDI audio
 class Synthesizer {
+  // renders shards
+  friend class ShardWorker;
+  // loads shards
+  friend class ShardLoader;
+
   public:
     Synthesizer();
     ~Synthesizer();
 
-    // initialize synthesizer and load soundfont
-    bool init(int rate, int polyphony, bool live);
+    // initialize synthesizer and load soundfont. channels are split
+    // across shardCount FluidSynth instances [channel % shardCount]
+    // and each shard past the first renders on a worker thread
+    bool init(int rate, int polyphony, bool live, int shardCount = 1);
+    // loads into every shard at once and blocks until done [safe
+    // on any thread, and the render thread stays quiet meanwhile]
     bool load(const char* path);
+    // shards with the soundfont in and whether a load is running
+    int getLoadedShards();
+    bool isLoading();
+    // programs each shard plays through once after loading
+    // so switching to them never hitches [set before load]
+    void setWarmPrograms(const set<int>& programs);
 
     // program change [set instrument]
     void setInstrument(int channel, int program);
@@ -37,13 +134,107 @@ class Synthesizer {
     // synthesize stereo buffer of samples
     bool synthesize(float* buffer, unsigned int numFrames);
 
-    // TODO: maybe make an accessor
+    // register a per block callback [NULL to remove]
+    void setBlockHandler(BlockHandler call, void* data);
+    // schedule a message inside the current block [block handler only]
+    bool scheduleCommand(unsigned int offset, int type, int channel, int dataOne, int dataTwo);
+
+    // accessors for block timing [micros is when
+    // the last block finished and of what size]
+    int getSampleRate();
+    unsigned long long getFrameCount();
+    unsigned long long getFrameMicros();
+    unsigned int getBlockFrames();
+
+    // linear gain of a channel on the master bus
+    void setChannelGain(int channel, float gain);
+    float getChannelGain(int channel);
+    // frames the master limiter delays output
+    unsigned int getLatency();
+    // levels each channel actually produced over
+    // the last ~20 ms [published by the render thread]
+    float getChannelRms(int channel);
+    float getChannelPeak(int channel);
+
+    // record queue to noteon latency [NULL to stop]
+    void setLatencyHistogram(Histogram* histogram);
+    int getShardCount();
+
+    // first shard [also the readiness check]
     fluid_synth_t* synth;
+    // only guards setup and teardown
     ofMutex synthLock;
 
   protected:
+    // queue a message for the next render block
+    void sendCommand(int type, int channel, int dataOne, int dataTwo);
+    // apply queued messages on the render thread
+    void drainCommands();
+    void applyCommand(const SynthCommand& command);
+
+    // render one chunk across every shard and mix
+    bool renderBlock(float* buffer, unsigned int numFrames);
+    // keep time with silence while a soundfont loads
+    bool renderLoading(float* buffer, unsigned int numFrames);
+    // load one shard [from a loader thread or load]
+    bool loadShard(int shard, const char* path);
+    // page in and cache the warm programs on one shard
+    void warmShard(int shard);
+    // render one shard applying its timed messages
+    bool renderShard(int shard, float* buffer, unsigned int numFrames);
+    // render a shard's channels and mix them at their gains
+    int writeShard(int shard, float* buffer, unsigned int numFrames);
+    int getShard(int channel);
+
+    // called by the live audio driver for every block
+    static int audioCallback(void* data, int len, int nin, float** in, int nout, float** out);
+
     fluid_settings_t* settings;
     fluid_audio_driver_t* driver;
+
+    // one synth per shard and with more than one
+    // shard a buffer each plus workers [NULL at 0]
+    vector<fluid_synth_t*> shards;
+    vector<float*> shardBuffers;
+    vector<ShardWorker*> workers;
+
+    // per channel render targets for each shard,
+    // the channels it owns, and master processing
+    vector<ChannelBuffers> channelBuffers;
+    vector<unsigned int> shardMasks;
+    MasterBus masterBus;
+
+    // every producer thread pushes here
+    RingBuffer<SynthCommand> commands;
+
+    // the render thread makes no shard calls while loading
+    // and keeps each channel's program to apply once it is
+    // over. load waits out any block already using them
+    volatile bool loading;
+    volatile bool rendering;
+    volatile int loadedShards;
+    int heldPrograms[16];
+    bool programsHeld;
+    set<int> warmPrograms;
+
+    // interleaved scratch for live mode
+    float* liveBuffer;
+    unsigned int liveFrames;
+
+    // block handler and what it scheduled
+    BlockHandler blockHandler;
+    void* blockData;
+    ofMutex blockLock;
+    vector<TimedCommand> timedCommands;
+
+    // running render position
+    volatile unsigned long long frameCount;
+    volatile unsigned long long frameMicros;
+    volatile unsigned int blockFrames;
+    int sampleRate;
+
+    // keypress timing
+    Histogram* latencyHistogram;
 };
 
 // guard
@@ -0,0 +1,82 @@
+/**
+ * File: textcache.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Keeps a glyph mesh per label so
+ * text is laid out once and drawn
+ * from the font texture after.
+ */
+
+#include "textcache.h"
+using namespace std;
+
+// labels are short and come from a small set
+// [numbers, tempos, names] but never grow forever
+const int TEXT_CACHE_LIMIT = 512;
+
+/**
+ * Constructor: TextCache
+ * ----------------------
+ * Starts with no font.
+ */
+TextCache::TextCache() : font(NULL) {}
+
+/**
+ * Function: setFont
+ * -----------------
+ * Sets the font meshes come from.
+ */
+void TextCache::setFont(ofTrueTypeFont* newFont) {
+  font = newFont;
+  clear();
+}
+
+/**
+ * Function: draw
+ * --------------
+ * Draws one string from its cached mesh
+ * and the font texture, building the
+ * mesh first on a miss.
+ */
+void TextCache::draw(const string& text, float x, float y, const ofColor& color) {
+  if (font == NULL || !font -> isLoaded()) return;
+
+  map<string, ofVboMesh>::iterator found = meshes.find(text);
+  if (found == meshes.end()) {
+    if (meshes.size() >= TEXT_CACHE_LIMIT) clear();
+    found = meshes.insert(make_pair(text, ofVboMesh())).first;
+    found -> second = font -> getStringMesh(text, 0, 0);
+    found -> second.setUsage(GL_STATIC_DRAW);
+  }
+
+  ofSetColor(color);
+  ofPushMatrix(); // mesh is at the origin
+  ofTranslate(x, y);
+
+  font -> getFontTexture().bind();
+  found -> second.draw();
+  font -> getFontTexture().unbind();
+
+  // all done
+  ofPopMatrix();
+}
+
+/**
+ * Function: clear
+ * ---------------
+ * Forgets every mesh.
+ */
+void TextCache::clear() {
+  // just a mutator because style
+  meshes.clear();
+}
+
+/**
+ * Function: getSize
+ * -----------------
+ * Get the cached string count.
+ */
+int TextCache::getSize() {
+  // just an accessor because style
+  return meshes.size();
+}
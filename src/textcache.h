@@ -0,0 +1,42 @@
+/**
+ * File: textcache.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Keeps a glyph mesh per label so
+ * text is laid out once and drawn
+ * from the font texture after.
+ */
+
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include <map>
+#include <string>
+#include "ofMain.h"
+using namespace std;
+
+// glyph meshes by string
+class TextCache {
+  public:
+    TextCache();
+
+    // font to lay text out with [clears the cache]
+    void setFont(ofTrueTypeFont* font);
+    // draw text with its baseline starting at x and y,
+    // building its mesh only the first time it is seen
+    void draw(const string& text, float x, float y, const ofColor& color);
+    // forget every mesh [after the font reloads]
+    void clear();
+
+    // number of cached strings
+    int getSize();
+
+  protected:
+    // laid out at the origin and
+    // moved into place when drawn
+    map<string, ofVboMesh> meshes;
+    ofTrueTypeFont* font;
+};
+
+// guard
+#endif
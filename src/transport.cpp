@@ -0,0 +1,182 @@
+/**
+ * File: transport.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * One timebase for playback, recording,
+ * and graphics that counts audio frames
+ * and places beats exactly from tempo.
+ */
+
+#include "transport.h"
+using namespace std;
+
+/**
+ * Constructor: Transport
+ * ----------------------
+ * Runs on the wall clock at 44.1
+ * kHz until given something else.
+ */
+Transport::Transport()
+  : source(NULL), sampleRate(44100), smoothing(true), beatsPerMinute(120), origin(0),
+    originBeats(0), originDivisions(1), lastFrame(0) {}
+
+/**
+ * Function: init
+ * --------------
+ * Counts the frames a synth
+ * has rendered at its rate.
+ */
+void Transport::init(Synthesizer* synth) {
+  source = synth;
+  sampleRate = synth -> getSampleRate();
+  lastFrame = 0;
+}
+
+/**
+ * Function: init
+ * --------------
+ * Counts wall clock frames at
+ * a rate with no synth behind.
+ */
+void Transport::init(int rate) {
+  source = NULL;
+  sampleRate = rate;
+  lastFrame = 0;
+}
+
+/**
+ * Function: getFrame
+ * ------------------
+ * Frames rendered so far plus the time since
+ * the last block, capped at one block so the
+ * clock never runs ahead of the audio.
+ */
+unsigned long long Transport::getFrame() {
+  unsigned long long micros = ofGetElapsedTimeMicros();
+  unsigned long long frame = micros * sampleRate / 1000000;
+
+  if (source) { // audio frames
+    unsigned long long rendered = source -> getFrameCount();
+    unsigned long long stamp = source -> getFrameMicros();
+    unsigned long long since = micros > stamp ? micros - stamp : 0;
+    unsigned long long ahead = since * sampleRate / 1000000;
+    frame = rendered + min(ahead, (unsigned long long) source -> getBlockFrames());
+    if (!smoothing) frame = rendered;
+  }
+
+  // a block landing between reads
+  if (frame < lastFrame) frame = lastFrame;
+  lastFrame = frame;
+  return frame;
+}
+
+/**
+ * Function: getMillis
+ * -------------------
+ * Get milliseconds so far.
+ */
+long long Transport::getMillis() {
+  // same clock in coarser units
+  return getFrame() * 1000 / sampleRate;
+}
+
+/**
+ * Function: getSampleRate
+ * -----------------------
+ * Get frames per second.
+ */
+int Transport::getSampleRate() {
+  // just an accessor because style
+  return sampleRate;
+}
+
+/**
+ * Function: setSmoothing
+ * ----------------------
+ * Sets whether synth frames are
+ * interpolated between blocks.
+ */
+void Transport::setSmoothing(bool smooth) {
+  // just a mutator because style
+  smoothing = smooth;
+}
+
+/**
+ * Function: setTempo
+ * ------------------
+ * Sets beats per minute.
+ */
+void Transport::setTempo(int bpm) {
+  // bounded so beat math never divides by zero
+  beatsPerMinute = bpm > 0 ? bpm : 1;
+}
+
+/**
+ * Function: setOrigin
+ * -------------------
+ * Sets the frame of beat zero.
+ */
+void Transport::setOrigin(unsigned long long frame) {
+  origin = frame;
+  originBeats = 0;
+  originDivisions = 1;
+}
+
+/**
+ * Function: getBeatsPerMinute
+ * ---------------------------
+ * Get the tempo.
+ */
+int Transport::getBeatsPerMinute() {
+  // just an accessor because style
+  return beatsPerMinute;
+}
+
+/**
+ * Function: getOrigin
+ * -------------------
+ * Get the frame of beat zero.
+ */
+unsigned long long Transport::getOrigin() {
+  // just an accessor because style
+  return origin;
+}
+
+/**
+ * Function: changeTempo
+ * ---------------------
+ * Moves the origin to the change so
+ * only later beats use the new tempo.
+ */
+void Transport::changeTempo(int bpm, long long beats, long long divisions) {
+  origin = getFrameAt(beats, divisions);
+  originBeats = beats;
+  originDivisions = divisions;
+  setTempo(bpm);
+}
+
+/**
+ * Function: getFrameAt
+ * --------------------
+ * Every beat is placed from the origin
+ * with one division so rounding never
+ * builds up across beats or loops.
+ */
+unsigned long long Transport::getFrameAt(long long beats, long long divisions) {
+  long long rate = sampleRate;
+  long long since = beats * originDivisions - originBeats * divisions;
+  return origin + since * rate * 60 / (divisions * originDivisions * beatsPerMinute);
+}
+
+/**
+ * Function: getBeatAt
+ * -------------------
+ * Inverse of getFrameAt rounded down,
+ * and zero for frames before beat zero.
+ */
+long long Transport::getBeatAt(unsigned long long frame, long long divisions) {
+  long long rate = sampleRate;
+  long long atOrigin = originBeats * divisions / originDivisions;
+  if (frame < origin) return atOrigin;
+  return atOrigin + (long long) (frame - origin) * beatsPerMinute * divisions / (rate * 60);
+}
@@ -0,0 +1,69 @@
+/**
+ * File: transport.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * One timebase for playback, recording,
+ * and graphics that counts audio frames
+ * and places beats exactly from tempo.
+ */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include "synthesizer.h"
+
+// frame clock and tempo grid
+class Transport {
+  public:
+    Transport();
+
+    // count frames rendered by a synth
+    void init(Synthesizer* synth);
+    // count wall clock frames at a rate instead [or
+    // just do beat math for some other tick clock]
+    void init(int rate);
+
+    // frames so far, moving smoothly between render
+    // blocks and never backwards [UI thread only]
+    unsigned long long getFrame();
+    // milliseconds so far derived from frames
+    long long getMillis();
+    int getSampleRate();
+    // off to only count whole rendered blocks [for
+    // offline runs where time moves with rendering]
+    void setSmoothing(bool smooth);
+
+    // tempo and the frame where beat zero lands
+    void setTempo(int beatsPerMinute);
+    void setOrigin(unsigned long long frame);
+    int getBeatsPerMinute();
+    unsigned long long getOrigin();
+
+    // change tempo from beats / divisions on [that beat keeps
+    // its frame and only later beats should be asked for]
+    void changeTempo(int beatsPerMinute, long long beats, long long divisions = 1);
+
+    // frame where beats / divisions lands past the origin
+    unsigned long long getFrameAt(long long beats, long long divisions = 1);
+    // whole divisions of a beat from the origin to a frame
+    long long getBeatAt(unsigned long long frame, long long divisions = 1);
+
+  protected:
+    Synthesizer* source;
+    int sampleRate;
+    bool smoothing;
+
+    int beatsPerMinute;
+    unsigned long long origin;
+
+    // beat at the origin as a fraction
+    // [moves forward on tempo changes]
+    long long originBeats;
+    long long originDivisions;
+
+    // last value handed out
+    unsigned long long lastFrame;
+};
+
+// guard
+#endif
@@ -0,0 +1,158 @@
+/**
+ * File: voicetable.cpp
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Fixed table of held free play
+ * notes with one slot per letter
+ * key and a polyphony limit.
+ */
+
+#include "voicetable.h"
+using namespace std;
+
+/**
+ * Constructor: VoiceTable
+ * -----------------------
+ * Starts with every slot free
+ * and every key available.
+ */
+VoiceTable::VoiceTable()
+  : polyphony(VOICE_SLOTS), stealPolicy(STEAL_OLDEST), activeCount(0), pressCount(0) {
+  for (int i = 0; i < VOICE_SLOTS; i += 1) {
+    voices[i].active = false;
+    voices[i].key = 'a' + i;
+  }
+}
+
+/**
+ * Function: setPolyphony
+ * ----------------------
+ * Sets the most voices held at
+ * once. Voices already held over
+ * a lower limit are kept.
+ */
+void VoiceTable::setPolyphony(int limit) {
+  if (limit < 1) limit = 1;
+  else if (limit > VOICE_SLOTS) limit = VOICE_SLOTS;
+  polyphony = limit;
+}
+
+/**
+ * Function: setStealPolicy
+ * ------------------------
+ * Sets who gives way when full.
+ */
+void VoiceTable::setStealPolicy(int policy) {
+  // just a mutator because style
+  stealPolicy = policy;
+}
+
+/**
+ * Function: getPolyphony
+ * ----------------------
+ * Get the voice limit.
+ */
+int VoiceTable::getPolyphony() {
+  // just an accessor because style
+  return polyphony;
+}
+
+/**
+ * Function: getActiveCount
+ * ------------------------
+ * Get the voices held.
+ */
+int VoiceTable::getActiveCount() {
+  // just an accessor because style
+  return activeCount;
+}
+
+/**
+ * Function: find
+ * --------------
+ * Get the held voice for a key.
+ */
+Voice* VoiceTable::find(char key) {
+  if (key < 'a' || key > 'z') return NULL;
+  Voice* voice = &voices[key - 'a'];
+  return voice -> active ? voice : NULL;
+}
+
+/**
+ * Function: isFull
+ * ----------------
+ * Whether the limit is reached.
+ */
+bool VoiceTable::isFull() {
+  // just an accessor because style
+  return activeCount >= polyphony;
+}
+
+/**
+ * Function: getVictim
+ * -------------------
+ * Picks the voice to steal by policy
+ * with ties going to the older one.
+ */
+Voice* VoiceTable::getVictim() {
+  if (!isFull() || stealPolicy == STEAL_NONE) return NULL;
+  Voice* victim = NULL;
+
+  for (int i = 0; i < VOICE_SLOTS; i += 1) {
+    Voice* voice = &voices[i];
+    if (!voice -> active) continue;
+    if (victim == NULL) {
+      victim = voice;
+      continue;
+    }
+
+    bool older = voice -> order < victim -> order;
+    if (stealPolicy == STEAL_QUIETEST) {
+      if (voice -> velocity < victim -> velocity) victim = voice;
+      else if (voice -> velocity == victim -> velocity && older) victim = voice;
+    }
+
+    else if (older) victim = voice;
+  }
+
+  return victim;
+}
+
+/**
+ * Function: start
+ * ---------------
+ * Claims the slot of a key. The caller
+ * fills in the note and its blocks.
+ */
+Voice* VoiceTable::start(char key) {
+  if (key < 'a' || key > 'z') return NULL;
+  Voice* voice = &voices[key - 'a'];
+  if (voice -> active) return voice;
+
+  voice -> active = true;
+  voice -> order = pressCount++;
+  voice -> retriggers = 0;
+  activeCount += 1;
+  return voice;
+}
+
+/**
+ * Function: stop
+ * --------------
+ * Frees the slot of a voice.
+ */
+void VoiceTable::stop(Voice* voice) {
+  if (voice == NULL || !voice -> active) return;
+  voice -> active = false;
+  activeCount -= 1;
+}
+
+/**
+ * Function: getSlot
+ * -----------------
+ * Get a slot by index.
+ */
+const Voice& VoiceTable::getSlot(int index) {
+  // just an accessor because style
+  return voices[index];
+}
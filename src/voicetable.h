@@ -0,0 +1,81 @@
+/**
+ * File: voicetable.h
+ * Author: Sanjay Kannan
+ * ---------------------
+ * Fixed table of held free play
+ * notes with one slot per letter
+ * key and a polyphony limit.
+ */
+
+#ifndef VOICETABLE_H
+#define VOICETABLE_H
+
+#include "layer.h"
+
+// one slot per letter key
+const int VOICE_SLOTS = 26;
+
+// which held note gives way when
+// the polyphony limit is reached
+enum StealPolicy {
+  STEAL_OLDEST, // first pressed
+  STEAL_QUIETEST, // lowest velocity
+  STEAL_NONE // refuse new notes
+};
+
+// a held free play note
+struct Voice {
+  bool active;
+  char key;
+
+  // as started [the mapping may change]
+  int pitch;
+  int position;
+  int velocity;
+  long startTime; // audio ms
+
+  // press order and repeat presses
+  // [like key repeat] while held
+  unsigned int order;
+  int retriggers;
+
+  // blocks to finalize on release
+  NoteBlocks blocks;
+};
+
+// held notes by key
+class VoiceTable {
+  public:
+    VoiceTable();
+
+    // limit is capped at the slot count
+    void setPolyphony(int limit);
+    void setStealPolicy(int policy);
+    int getPolyphony();
+    int getActiveCount();
+
+    // held voice for a letter key or NULL
+    Voice* find(char key);
+    // voice to release before another can start, or
+    // NULL if there is room or the policy refuses
+    Voice* getVictim();
+    bool isFull();
+
+    // claim the slot of a key [check isFull first]
+    Voice* start(char key);
+    // free a voice's slot
+    void stop(Voice* voice);
+
+    // every slot for inspection
+    const Voice& getSlot(int index);
+
+  protected:
+    Voice voices[VOICE_SLOTS];
+    int polyphony;
+    int stealPolicy;
+    int activeCount;
+    unsigned int pressCount;
+};
+
+// guard
+#endif